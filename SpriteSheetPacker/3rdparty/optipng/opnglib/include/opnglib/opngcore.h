@@ -132,6 +132,31 @@ opng_optimize_file(opng_optimizer_t *optimizer,
                    const char *out_fname,
                    const char *out_dirname);
 
+/**
+ * Optimizes an image given as 8-bit RGBA pixels, and writes it
+ * to a new PNG file.
+ * @param optimizer
+ *        the optimizer object.
+ * @param pixels
+ *        the image rows, top-down, 4 bytes per pixel in R, G, B, A order.
+ * @param width
+ *        the image width.
+ * @param height
+ *        the image height.
+ * @param stride
+ *        the distance in bytes between the starts of two rows.
+ * @param out_fname
+ *        the output file name.
+ * @return 0 on success, or a non-zero exit code on failure.
+ **/
+int
+opng_optimize_rgba(opng_optimizer_t *optimizer,
+                   const unsigned char *pixels,
+                   unsigned int width,
+                   unsigned int height,
+                   size_t stride,
+                   const char *out_fname);
+
 #if 0  /* not implemented */
 /**
  * Optimizes an image object.
@@ -149,6 +174,35 @@ opng_optimize_image(opng_optimizer_t *optimizer,
                     const char *out_fname);
 #endif
 
+/**
+ * Runs the compression trials of an optimization session.
+ * The runner shall call @c trial(trial_arg, index) once for every index
+ * in the range [0, count), in any order and from any number of threads,
+ * and return after all these calls have returned.
+ * The trials should be started in the index order: the first trials
+ * set the size limit that lets the others stop early.
+ **/
+typedef void (*opng_trial_runner_t)(void (*trial)(void *trial_arg, int index),
+                                    void *trial_arg,
+                                    int count,
+                                    void *user_arg);
+
+/**
+ * Sets the runner of the compression trials in an optimizer object.
+ * The selected trial is the same as with the trials run in sequence.
+ * @param optimizer
+ *        the optimizer object.
+ * @param runner
+ *        the trial runner, or @c NULL to run the trials in sequence
+ *        (the default).
+ * @param user_arg
+ *        the argument passed to the runner.
+ **/
+void
+opng_set_trial_runner(opng_optimizer_t *optimizer,
+                      opng_trial_runner_t runner,
+                      void *user_arg);
+
 /**
  * Destroys an optimizer object.
  * @param optimizer
@@ -49,7 +49,8 @@
  * See cexcept.h for more info
  */
 define_exception_type(const char *);
-struct exception_context the_exception_context[1];
+OPNG_THREAD_LOCAL
+struct exception_context the_exception_context[1];  /* one per thread */
 
 
 /*
@@ -429,6 +430,10 @@ opng_write_data(png_structp png_ptr, png_bytep data, size_t length)
             {
                 if (stats->idat_size > context->expected_idat_size)
                     Throw NULL;  /* early interruption, not an error */
+                if (context->shared_idat_size != NULL &&
+                    stats->idat_size >
+                        opng_atomic_load_fsize(context->shared_idat_size))
+                    Throw NULL;  /* a concurrent trial did better */
             }
         }
         else  /* not IDAT */
@@ -654,6 +659,67 @@ opng_decode_image(struct opng_codec_context *context,
     return 0;
 }
 
+/*
+ * Imports an image from 8-bit RGBA pixels in memory.
+ * The function returns 0 on success or -1 on error.
+ */
+int
+opng_decode_rgba_image(struct opng_codec_context *context,
+                       const png_byte *pixels,
+                       png_uint_32 width,
+                       png_uint_32 height,
+                       size_t stride,
+                       const char *fname)
+{
+    png_bytepp rows;
+    png_uint_32 i;
+    const char * volatile err_msg;  /* volatile is required by cexcept */
+
+    context->libpng_ptr =
+        png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL,
+                               opng_read_error, opng_read_warning);
+    context->info_ptr = png_create_info_struct(context->libpng_ptr);
+    if (context->libpng_ptr == NULL || context->info_ptr == NULL)
+    {
+        opng_error(NULL, "Out of memory", NULL);
+        png_destroy_read_struct(&context->libpng_ptr,
+                                &context->info_ptr, NULL);
+        return -1;
+    }
+
+    opng_init_image(context->image);
+    opng_init_stats(context->stats);
+    context->stream = NULL;
+    context->fname = fname;
+
+    Try
+    {
+        /* Nothing is read, but the error callbacks need the context. */
+        png_set_read_fn(context->libpng_ptr, context, opng_read_data);
+        png_set_IHDR(context->libpng_ptr, context->info_ptr,
+                     width, height, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+                     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+                     PNG_FILTER_TYPE_BASE);
+        rows = pngx_malloc_rows(context->libpng_ptr, context->info_ptr, -1);
+        if (rows == NULL)
+            png_error(context->libpng_ptr, "Out of memory");
+        for (i = 0; i < height; ++i)
+            memcpy(rows[i], pixels + i * stride, (size_t)width * 4);
+    }
+    Catch (err_msg)
+    {
+        OPNG_ASSERT(err_msg != NULL, "No error message");
+        opng_error(fname, err_msg, NULL);
+        return -1;
+    }
+
+    opng_load_image(context->image,
+                    context->libpng_ptr,
+                    context->info_ptr,
+                    1);
+    return 0;
+}
+
 /*
  * Attempts to reduce the imported image.
  */
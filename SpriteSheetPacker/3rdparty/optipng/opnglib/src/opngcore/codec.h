@@ -77,6 +77,7 @@ struct opng_codec_context
     optk_foffset_t crt_idat_offset;
     optk_fsize_t crt_idat_size;
     optk_fsize_t expected_idat_size;
+    volatile optk_fsize_t *shared_idat_size;  /* limit of concurrent trials */
     png_uint_32 crt_idat_crc;
     int crt_chunk_is_allowed;
     int crt_chunk_is_idat;
@@ -144,6 +145,19 @@ opng_decode_image(struct opng_codec_context *context,
                   const char **format_name_ptr,
                   const char **format_xdesc_ptr);
 
+/*
+ * Decodes an image from 8-bit RGBA pixels in memory,
+ * rows top-down, stride bytes apart.
+ * The function returns 0 on success or -1 on error.
+ */
+int
+opng_decode_rgba_image(struct opng_codec_context *context,
+                       const png_byte *pixels,
+                       png_uint_32 width,
+                       png_uint_32 height,
+                       size_t stride,
+                       const char *fname);
+
 /*
  * Attempts to reduce the imported image.
  * The function returns a mask of successful reductions (0 for no reductions),
@@ -56,6 +56,8 @@ struct opng_optimizer
 {
     const opng_transformer_t *transformer;
     struct opng_options options;
+    opng_trial_runner_t trial_runner;
+    void *trial_runner_arg;
     unsigned int file_count;
     unsigned int err_count;
     unsigned int fix_count;
@@ -74,7 +76,7 @@ struct opng_session
     const char *in_fname;
     const char *out_fname;
     optk_fsize_t best_idat_size;
-    optk_fsize_t max_idat_size;
+    volatile optk_fsize_t max_idat_size;  /* shared by concurrent trials */
     png_uint_32 flags;
     optk_bits_t filter_set;
     optk_bits_t zcompr_level_set;
@@ -82,6 +84,23 @@ struct opng_session
     optk_bits_t zstrategy_set;
     struct opng_encoding_params best_params;
     int num_iterations;
+    opng_trial_runner_t trial_runner;
+    void *trial_runner_arg;
+};
+
+/*
+ * The compression trial structures
+ */
+struct opng_trial
+{
+    struct opng_encoding_params params;
+    struct opng_encoding_stats stats;
+};
+
+struct opng_trial_set
+{
+    struct opng_session *session;
+    struct opng_trial *trials;
 };
 
 
@@ -377,46 +396,20 @@ opng_print_status_report(const struct opng_optimizer *optimizer)
 }
 
 /*
- * Reads an image from an image file stream.
- * Reduces the image if possible.
+ * Transforms and reduces a decoded image, then stops the decoder.
  */
 static int
-opng_read_file(struct opng_session *session, FILE *stream)
+opng_prepare_image(struct opng_session *session,
+                   struct opng_codec_context *context)
 {
-    struct opng_codec_context context;
     const struct opng_options *options;
     struct opng_image *image;
     struct opng_encoding_stats *stats;
-    const char *format_name;
-    const char *format_xdesc;
     int reductions;
 
     options = session->options;
     image = &session->image;
     stats = &session->in_stats;
-    opng_init_codec_context(&context,
-                            image,
-                            stats,
-                            0,
-                            session->transformer);
-    if (opng_decode_image(&context, stream, session->in_fname,
-                          &format_name, &format_xdesc) < 0)
-    {
-        opng_decode_finish(&context, 1);
-        return -1;
-    }
-
-    /* Display the input image file information. */
-    opng_print_image_format_line(image, format_name, format_xdesc);
-    opng_print_image_info_line(image);
-    if (stats->flags & OPNG_HAS_PNG_DATASTREAM)
-    {
-        opng_print_idat_size_line(stats->idat_size);
-        OPNG_WEAK_ASSERT(stats->idat_size != 0, "IDAT not found inside PNG");
-    }
-    else
-        OPNG_WEAK_ASSERT(stats->idat_size == 0, "IDAT found outside PNG");
-    opng_print_file_size_line(stats->file_size);
 
     if (stats->flags & OPNG_HAS_SNIPPED_IMAGES)
     {
@@ -433,7 +426,7 @@ opng_read_file(struct opng_session *session, FILE *stream)
     /* Set/reset image data objects, if applicable.
      * This operation must be done before reductions.
      */
-    if (opng_decode_transform_image(&context))
+    if (opng_decode_transform_image(context))
     {
         opng_printf("Transforming:\n");
         /* Recompression is mandatory after a successful transformation. */
@@ -470,7 +463,7 @@ opng_read_file(struct opng_session *session, FILE *stream)
     }
 
     /* Try to reduce the image. */
-    reductions = opng_decode_reduce_image(&context, reductions);
+    reductions = opng_decode_reduce_image(context, reductions);
     if (reductions != OPNG_REDUCE_NONE)
     {
         opng_printf("Reducing:\n");
@@ -480,7 +473,7 @@ opng_read_file(struct opng_session *session, FILE *stream)
     {
         opng_error(session->in_fname,
             "An unexpected error occurred while reducing the image", NULL);
-        opng_decode_finish(&context, 1);
+        opng_decode_finish(context, 1);
         return -1;
     }
 
@@ -494,10 +487,81 @@ opng_read_file(struct opng_session *session, FILE *stream)
     }
 
     /* Keep the loaded image data. */
-    opng_decode_finish(&context, 0);
+    opng_decode_finish(context, 0);
     return 0;
 }
 
+/*
+ * Reads an image from an image file stream.
+ * Reduces the image if possible.
+ */
+static int
+opng_read_file(struct opng_session *session, FILE *stream)
+{
+    struct opng_codec_context context;
+    struct opng_image *image;
+    struct opng_encoding_stats *stats;
+    const char *format_name;
+    const char *format_xdesc;
+
+    image = &session->image;
+    stats = &session->in_stats;
+    opng_init_codec_context(&context,
+                            image,
+                            stats,
+                            0,
+                            session->transformer);
+    if (opng_decode_image(&context, stream, session->in_fname,
+                          &format_name, &format_xdesc) < 0)
+    {
+        opng_decode_finish(&context, 1);
+        return -1;
+    }
+
+    /* Display the input image file information. */
+    opng_print_image_format_line(image, format_name, format_xdesc);
+    opng_print_image_info_line(image);
+    if (stats->flags & OPNG_HAS_PNG_DATASTREAM)
+    {
+        opng_print_idat_size_line(stats->idat_size);
+        OPNG_WEAK_ASSERT(stats->idat_size != 0, "IDAT not found inside PNG");
+    }
+    else
+        OPNG_WEAK_ASSERT(stats->idat_size == 0, "IDAT found outside PNG");
+    opng_print_file_size_line(stats->file_size);
+
+    return opng_prepare_image(session, &context);
+}
+
+/*
+ * Reads an image from 8-bit RGBA pixels in memory.
+ * Reduces the image if possible.
+ */
+static int
+opng_read_rgba(struct opng_session *session,
+               const unsigned char *pixels,
+               unsigned int width,
+               unsigned int height,
+               size_t stride)
+{
+    struct opng_codec_context context;
+
+    opng_init_codec_context(&context,
+                            &session->image,
+                            &session->in_stats,
+                            0,
+                            session->transformer);
+    if (opng_decode_rgba_image(&context, pixels, width, height, stride,
+                               session->in_fname) < 0)
+    {
+        opng_decode_finish(&context, 1);
+        return -1;
+    }
+
+    opng_print_image_info_line(&session->image);
+    return opng_prepare_image(session, &context);
+}
+
 /*
  * Writes an image to a PNG file stream.
  * Performs the encoding without any I/O, if the given stream is NULL.
@@ -638,6 +702,39 @@ opng_init_iterations(struct opng_session *session)
     OPNG_ASSERT(session->num_iterations > 0, "Invalid iteration parameters");
 }
 
+/*
+ * Compression trial
+ * The trials of a session are independent and may run concurrently.
+ * Each one encodes without any I/O into its own stats, and is abandoned
+ * as soon as its IDAT grows bigger than the smallest one completed.
+ */
+static void
+opng_run_trial(void *trial_arg, int index)
+{
+    struct opng_trial_set *trial_set;
+    struct opng_session *session;
+    struct opng_trial *trial;
+    struct opng_codec_context context;
+    optk_fsize_t out_idat_size;
+
+    trial_set = (struct opng_trial_set *)trial_arg;
+    session = trial_set->session;
+    trial = &trial_set->trials[index];
+
+    opng_init_codec_context(&context,
+                            &session->image,
+                            &trial->stats,
+                            opng_atomic_load_fsize(&session->max_idat_size),
+                            session->transformer);
+    context.shared_idat_size = &session->max_idat_size;
+    opng_encode_image(&context, &trial->params, NULL, session->in_fname);
+    opng_encode_finish(&context);
+
+    out_idat_size = trial->stats.idat_size;
+    if (out_idat_size <= OPNG_IDAT_SIZE_MAX && !session->options->paranoid)
+        opng_atomic_min_fsize(&session->max_idat_size, out_idat_size);
+}
+
 /*
  * Iteration
  */
@@ -648,10 +745,13 @@ opng_iterate(struct opng_session *session)
     optk_bits_t filter_set, zcompr_level_set, zmem_level_set, zstrategy_set;
     optk_bits_t saved_zcompr_level_set;
     struct opng_encoding_params params;
+    struct opng_trial_set trial_set;
+    struct opng_trial *trials;
     int filter, zcompr_level, zmem_level, zstrategy;
     optk_fsize_t out_idat_size;
     int counter;
     int line_reused;
+    int i;
 
     options = session->options;
 
@@ -677,6 +777,7 @@ opng_iterate(struct opng_session *session)
     zcompr_level_set = session->zcompr_level_set;
     zmem_level_set = session->zmem_level_set;
     zstrategy_set = session->zstrategy_set;
+    memset(&params, 0, sizeof(params));
     params.filter = -1;
     params.zcompr_level = -1;
     params.zmem_level = -1;
@@ -684,13 +785,11 @@ opng_iterate(struct opng_session *session)
     params.zwindow_bits = options->zwindow_bits;
     session->best_params = params;
     session->best_idat_size = OPNG_IDAT_SIZE_MAX + 1;
+    trials = (struct opng_trial *)
+        opng_xmalloc(session->num_iterations * sizeof(struct opng_trial));
+    memset(trials, 0, session->num_iterations * sizeof(struct opng_trial));
 
-    /* Iterate through the "hyper-rectangle" (zc, zm, zs, f). */
-    if (session->num_iterations == 1)
-        opng_printf("Trying: 1 combination\n");
-    else
-        opng_printf("Trying: %d combinations\n", session->num_iterations);
-    line_reused = 0;
+    /* List the "hyper-rectangle" (zc, zm, zs, f). */
     counter = 0;
     for (filter = OPNG_FILTER_MIN;
          filter <= OPNG_FILTER_MAX; ++filter)
@@ -726,40 +825,15 @@ opng_iterate(struct opng_session *session)
                       {
                          if (optk_bits_test(zmem_level_set, zmem_level))
                          {
-                            ++counter;
+                            OPNG_ASSERT(counter < session->num_iterations,
+                                        "Inconsistent iteration counter");
                             params.filter = filter;
                             params.zcompr_level = zcompr_level;
                             params.zmem_level = zmem_level;
                             params.zstrategy = zstrategy;
                             /* Leave params.zwindow_bits intact. */
-                            opng_print_encoding_line_begin(&params);
-                            opng_write_file(session, &params, NULL);
-                            if (session->out_stats.idat_size > OPNG_IDAT_SIZE_MAX)
-                            {
-                               if (options->verbose)
-                               {
-                                  opng_printf("\tIDAT too big\n");
-                                  line_reused = 0;
-                               }
-                               else
-                               {
-                                  opng_printf("\r");
-                                  line_reused = 1;
-                               }
-                               continue;
-                            }
-                            out_idat_size = session->out_stats.idat_size;
-                            opng_print_idat_size_line_end(out_idat_size);
-                            line_reused = 0;
-                            if (session->best_idat_size < out_idat_size)
-                               continue;  /* it's bigger */
-                            if (session->best_idat_size == out_idat_size &&
-                                session->best_params.zstrategy >= Z_HUFFMAN_ONLY)
-                               continue;  /* it's neither smaller nor faster */
-                            session->best_params = params;
-                            session->best_idat_size = out_idat_size;
-                            if (!options->paranoid)
-                               session->max_idat_size = out_idat_size;
+                            trials[counter].params = params;
+                            ++counter;
                          }
                       }
                    }
@@ -769,11 +843,64 @@ opng_iterate(struct opng_session *session)
           }
        }
     }
+    OPNG_ASSERT(counter == session->num_iterations,
+                "Inconsistent iteration counter");
+
+    /* Run the trials, possibly concurrently. */
+    if (session->num_iterations == 1)
+        opng_printf("Trying: 1 combination\n");
+    else
+        opng_printf("Trying: %d combinations\n", session->num_iterations);
+    trial_set.session = session;
+    trial_set.trials = trials;
+    if (session->trial_runner != NULL && counter > 1)
+        session->trial_runner(opng_run_trial, &trial_set, counter,
+                              session->trial_runner_arg);
+    else
+    {
+        for (i = 0; i < counter; ++i)
+            opng_run_trial(&trial_set, i);
+    }
+
+    /* Select the best trial in the iteration order. The abandoned trials
+     * are bigger than the smallest one, so the selection is the same
+     * whatever order the trials ran in.
+     */
+    line_reused = 0;
+    for (i = 0; i < counter; ++i)
+    {
+        params = trials[i].params;
+        opng_print_encoding_line_begin(&params);
+        if (trials[i].stats.idat_size > OPNG_IDAT_SIZE_MAX)
+        {
+           if (options->verbose)
+           {
+              opng_printf("\tIDAT too big\n");
+              line_reused = 0;
+           }
+           else
+           {
+              opng_printf("\r");
+              line_reused = 1;
+           }
+           continue;
+        }
+        out_idat_size = trials[i].stats.idat_size;
+        opng_print_idat_size_line_end(out_idat_size);
+        line_reused = 0;
+        if (session->best_idat_size < out_idat_size)
+           continue;  /* it's bigger */
+        if (session->best_idat_size == out_idat_size &&
+            session->best_params.zstrategy >= Z_HUFFMAN_ONLY)
+           continue;  /* it's neither smaller nor faster */
+        session->best_params = params;
+        session->best_idat_size = out_idat_size;
+    }
+    session->out_stats = trials[counter - 1].stats;
+    free(trials);
 
     if (line_reused)
         opng_print_erase_encoding_line_begin();
-    OPNG_ASSERT(counter == session->num_iterations,
-                "Inconsistent iteration counter");
 }
 
 /*
@@ -1015,6 +1142,60 @@ opng_optimize_impl(struct opng_session *session, opng_ioenv_t *ioenv)
     return 0;
 }
 
+/*
+ * In-memory image optimization
+ * There is no input datastream to keep, so the image is always encoded anew,
+ * straight into the output file.
+ */
+static int
+opng_optimize_rgba_impl(struct opng_session *session,
+                        const unsigned char *pixels,
+                        unsigned int width,
+                        unsigned int height,
+                        size_t stride)
+{
+    const struct opng_options *options;
+    FILE *out_stream;
+    int result;
+
+    opng_printf("Processing: %s\n", session->out_fname);
+    result = opng_read_rgba(session, pixels, width, height, stride);
+    if (result < 0)
+        return result;
+
+    options = session->options;
+    session->flags = session->in_stats.flags |
+                     OPNG_NEEDS_NEW_FILE | OPNG_NEEDS_NEW_IDAT;
+
+    opng_init_iterations(session);
+    opng_iterate(session);
+    opng_finish_iterations(session);
+
+    if (options->no_create)
+    {
+        opng_printf("No output: simulation mode.\n");
+        return 0;
+    }
+
+    out_stream = fopen(session->out_fname, "wb");
+    if (out_stream == NULL)
+    {
+        opng_error(session->out_fname, "Can't open file for writing", NULL);
+        return -1;
+    }
+    result = opng_write_file(session, &session->best_params, out_stream);
+    fclose(out_stream);
+    if (result < 0)
+    {
+        remove(session->out_fname);
+        return -1;
+    }
+
+    opng_print_idat_size_line(session->out_stats.idat_size);
+    opng_print_file_size_line(session->out_stats.file_size);
+    return 0;
+}
+
 /*
  * Creates an optimizer object.
  * This is designed to be thread-safe, but it currently is THREAD-UNSAFE.
@@ -1123,6 +1304,18 @@ opng_set_transformer(opng_optimizer_t *optimizer,
     optimizer->transformer = opng_seal_transformer(transformer);
 }
 
+/*
+ * Sets the runner of the compression trials in an optimizer object.
+ */
+void
+opng_set_trial_runner(opng_optimizer_t *optimizer,
+                      opng_trial_runner_t runner,
+                      void *user_arg)
+{
+    optimizer->trial_runner = runner;
+    optimizer->trial_runner_arg = user_arg;
+}
+
 /*
  * Optimizes an image file.
  */
@@ -1161,6 +1354,8 @@ opng_optimize_file(opng_optimizer_t *optimizer,
     memset(&session, 0, sizeof(session));
     session.options = options;
     session.transformer = optimizer->transformer;
+    session.trial_runner = optimizer->trial_runner;
+    session.trial_runner_arg = optimizer->trial_runner_arg;
     opng_init_image(&session.image);
     result = opng_optimize_impl(&session, ioenv);
 
@@ -1182,6 +1377,40 @@ opng_optimize_file(opng_optimizer_t *optimizer,
     return result;
 }
 
+/*
+ * Optimizes an image given as 8-bit RGBA pixels.
+ */
+int
+opng_optimize_rgba(opng_optimizer_t *optimizer,
+                   const unsigned char *pixels,
+                   unsigned int width,
+                   unsigned int height,
+                   size_t stride,
+                   const char *out_fname)
+{
+    struct opng_session session;
+    int result;
+
+    memset(&session, 0, sizeof(session));
+    session.options = &optimizer->options;
+    session.transformer = optimizer->transformer;
+    session.trial_runner = optimizer->trial_runner;
+    session.trial_runner_arg = optimizer->trial_runner_arg;
+    /* The trials report their errors against the output file. */
+    session.in_fname = out_fname;
+    session.out_fname = out_fname;
+    opng_init_image(&session.image);
+    result = opng_optimize_rgba_impl(&session, pixels, width, height, stride);
+
+    ++optimizer->file_count;
+    if (result != 0)
+        ++optimizer->err_count;
+
+    opng_clear_image(&session.image);
+    opng_printf("\n");
+    return result;
+}
+
 /*
  * Destroys an optimizer object.
  */
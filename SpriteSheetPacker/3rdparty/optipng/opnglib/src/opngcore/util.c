@@ -16,6 +16,10 @@
 
 #include "sysexits.h"
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #define OPNGLIB_INTERNAL
 #include "util.h"
 
@@ -102,6 +106,49 @@ opng_xrealloc(void *ptr, size_t size)
 }
 
 
+/*** Thread utilities ***/
+
+/*
+ * Loads a file size shared between threads.
+ */
+optk_fsize_t
+opng_atomic_load_fsize(volatile optk_fsize_t *ptr)
+{
+#if defined(_MSC_VER)
+    return (optk_fsize_t)_InterlockedCompareExchange64(
+        (volatile __int64 *)ptr, 0, 0);
+#else
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+ * Lowers a file size shared between threads to the given value,
+ * if the value is smaller.
+ */
+void
+opng_atomic_min_fsize(volatile optk_fsize_t *ptr, optk_fsize_t value)
+{
+    optk_fsize_t current;
+
+    current = opng_atomic_load_fsize(ptr);
+    while (value < current)
+    {
+#if defined(_MSC_VER)
+        optk_fsize_t previous = (optk_fsize_t)_InterlockedCompareExchange64(
+            (volatile __int64 *)ptr, (__int64)value, (__int64)current);
+        if (previous == current)
+            break;
+        current = previous;
+#else
+        if (__atomic_compare_exchange_n(ptr, &current, value, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            break;
+#endif
+    }
+}
+
+
 /*** Panic handling utilities ***/
 
 /*
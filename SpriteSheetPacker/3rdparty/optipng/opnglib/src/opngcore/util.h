@@ -17,6 +17,8 @@
 
 #include <stdlib.h>
 
+#include "io.h"
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -115,6 +117,32 @@ void *
 opng_xrealloc(void *ptr, size_t size);
 
 
+/*** Thread utilities ***/
+
+/*
+ * Storage class of the state kept per thread.
+ */
+#if defined(_MSC_VER)
+#define OPNG_THREAD_LOCAL __declspec(thread)
+#else
+#define OPNG_THREAD_LOCAL __thread
+#endif
+
+
+/*
+ * Loads a file size shared between threads.
+ */
+optk_fsize_t
+opng_atomic_load_fsize(volatile optk_fsize_t *ptr);
+
+/*
+ * Lowers a file size shared between threads to the given value,
+ * if the value is smaller.
+ */
+void
+opng_atomic_min_fsize(volatile optk_fsize_t *ptr, optk_fsize_t value);
+
+
 /*** Panic handling utilities ***/
 
 /*
@@ -20,6 +20,8 @@ Suite 330, Boston, MA 02111-1307 USA */
 
 #include <QPixmap>
 #include <QImage>
+#include <QTransform>
+#include "ImageTranspose.h"
 
 QImage rotate(int degrees, const QImage &src);
 QImage rotate90(const QImage &src);
@@ -40,33 +42,27 @@ QImage rotate(int degrees, const QImage &src) {
     }
 }
 QImage rotate90(const QImage &src) {
-    QImage dst(src.height(), src.width(), src.format());
-    for (int y=0;y<src.height();++y) {
-        const uint *srcLine = reinterpret_cast< const uint * >(src.scanLine(y));
-        for (int x=0;x<src.width();++x) {
-            dst.setPixel(src.height()-y-1, x, srcLine[x]);
-        }
+    if (src.depth() != 32) {
+        return src.transformed(QTransform().rotate(90));
     }
+    QImage dst(src.height(), src.width(), src.format());
+    ImageTranspose::rotate90(src.constBits(), src.bytesPerLine(), src.width(), src.height(), dst.bits(), dst.bytesPerLine());
     return dst;
 }
 QImage rotate180(const QImage &src) {
-    QImage dst(src.width(), src.height(), src.format());
-    for (int y=0;y<src.height();++y) {
-        const uint *srcLine = reinterpret_cast< const uint * >(src.scanLine(y));
-        for (int x=0;x<src.width();++x) {
-            dst.setPixel(src.width()-x-1, src.height()-y-1, srcLine[x]);
-        }
+    if (src.depth() != 32) {
+        return src.transformed(QTransform().rotate(180));
     }
+    QImage dst(src.width(), src.height(), src.format());
+    ImageTranspose::rotate180(src.constBits(), src.bytesPerLine(), src.width(), src.height(), dst.bits(), dst.bytesPerLine());
     return dst;
 }
 QImage rotate270(const QImage &src) {
-    QImage dst(src.height(), src.width(), src.format());
-    for (int y=0;y<src.height();++y) {
-        const uint *srcLine = reinterpret_cast< const uint * >(src.scanLine(y));
-        for (int x=0;x<src.width();++x) {
-            dst.setPixel(y, src.width()-x-1, srcLine[x]);
-        }
+    if (src.depth() != 32) {
+        return src.transformed(QTransform().rotate(270));
     }
+    QImage dst(src.height(), src.width(), src.format());
+    ImageTranspose::rotate270(src.constBits(), src.bytesPerLine(), src.width(), src.height(), dst.bits(), dst.bytesPerLine());
     return dst;
 }
 
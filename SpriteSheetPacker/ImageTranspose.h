@@ -0,0 +1,160 @@
+#ifndef IMAGETRANSPOSE_H
+#define IMAGETRANSPOSE_H
+
+#include <QtGlobal>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_TRANSPOSE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define IMAGE_TRANSPOSE_NEON
+#endif
+
+// Rotation of 32-bit pixel buffers by multiples of 90 degrees (clockwise), strides in bytes.
+// The image is walked in 16x16 tiles so the columns written stay in cache, every tile in 4x4 blocks
+// transposed in registers.
+namespace ImageTranspose {
+
+const int TileSize = 16;
+
+// d0..d3 = columns of the 4x4 block with rows s0..s3
+inline void transpose4x4(const quint32* s0, const quint32* s1, const quint32* s2, const quint32* s3,
+                         quint32* d0, quint32* d1, quint32* d2, quint32* d3) {
+#if defined(IMAGE_TRANSPOSE_SSE2)
+    __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s0));
+    __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1));
+    __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s2));
+    __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s3));
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d0), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d1), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d2), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d3), _mm_unpackhi_epi64(t2, t3));
+#elif defined(IMAGE_TRANSPOSE_NEON)
+    uint32x4x2_t t01 = vtrnq_u32(vld1q_u32(s0), vld1q_u32(s1));
+    uint32x4x2_t t23 = vtrnq_u32(vld1q_u32(s2), vld1q_u32(s3));
+    vst1q_u32(d0, vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0])));
+    vst1q_u32(d1, vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1])));
+    vst1q_u32(d2, vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0])));
+    vst1q_u32(d3, vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1])));
+#else
+    quint32* d[4] = { d0, d1, d2, d3 };
+    for (int i = 0; i < 4; ++i) {
+        quint32 p0 = s0[i], p1 = s1[i], p2 = s2[i], p3 = s3[i];
+        d[i][0] = p0; d[i][1] = p1; d[i][2] = p2; d[i][3] = p3;
+    }
+#endif
+}
+
+// d = 4 pixels of s in reverse order
+inline void reverse4(const quint32* s, quint32* d) {
+#if defined(IMAGE_TRANSPOSE_SSE2)
+    __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d), _mm_shuffle_epi32(r, _MM_SHUFFLE(0, 1, 2, 3)));
+#elif defined(IMAGE_TRANSPOSE_NEON)
+    uint32x4_t r = vrev64q_u32(vld1q_u32(s));
+    vst1q_u32(d, vcombine_u32(vget_high_u32(r), vget_low_u32(r)));
+#else
+    quint32 p0 = s[0], p1 = s[1], p2 = s[2], p3 = s[3];
+    d[0] = p3; d[1] = p2; d[2] = p1; d[3] = p0;
+#endif
+}
+
+inline const quint32* row(const uchar* bits, int stride, int y) {
+    return reinterpret_cast<const quint32*>(bits + (qptrdiff)y * stride);
+}
+
+inline quint32* row(uchar* bits, int stride, int y) {
+    return reinterpret_cast<quint32*>(bits + (qptrdiff)y * stride);
+}
+
+// dst (height x width): dst(height - 1 - y, x) = src(x, y)
+inline void rotate90(const uchar* src, int srcStride, int width, int height, uchar* dst, int dstStride) {
+    for (int ty = 0; ty < height; ty += TileSize) {
+        int ye = qMin(ty + TileSize, height);
+        for (int tx = 0; tx < width; tx += TileSize) {
+            int xe = qMin(tx + TileSize, width);
+            int y = ty;
+            for (; y + 4 <= ye; y += 4) {
+                // rows bottom up, so every column comes out reversed
+                const quint32* s0 = row(src, srcStride, y + 3);
+                const quint32* s1 = row(src, srcStride, y + 2);
+                const quint32* s2 = row(src, srcStride, y + 1);
+                const quint32* s3 = row(src, srcStride, y);
+                int dx = height - 4 - y;
+                int x = tx;
+                for (; x + 4 <= xe; x += 4) {
+                    transpose4x4(s0 + x, s1 + x, s2 + x, s3 + x,
+                                 row(dst, dstStride, x) + dx, row(dst, dstStride, x + 1) + dx,
+                                 row(dst, dstStride, x + 2) + dx, row(dst, dstStride, x + 3) + dx);
+                }
+                for (; x < xe; ++x) {
+                    quint32* d = row(dst, dstStride, x) + dx;
+                    d[0] = s0[x]; d[1] = s1[x]; d[2] = s2[x]; d[3] = s3[x];
+                }
+            }
+            for (; y < ye; ++y) {
+                const quint32* s = row(src, srcStride, y);
+                for (int x = tx; x < xe; ++x) {
+                    row(dst, dstStride, x)[height - 1 - y] = s[x];
+                }
+            }
+        }
+    }
+}
+
+// dst (height x width): dst(y, width - 1 - x) = src(x, y)
+inline void rotate270(const uchar* src, int srcStride, int width, int height, uchar* dst, int dstStride) {
+    for (int ty = 0; ty < height; ty += TileSize) {
+        int ye = qMin(ty + TileSize, height);
+        for (int tx = 0; tx < width; tx += TileSize) {
+            int xe = qMin(tx + TileSize, width);
+            int y = ty;
+            for (; y + 4 <= ye; y += 4) {
+                const quint32* s0 = row(src, srcStride, y);
+                const quint32* s1 = row(src, srcStride, y + 1);
+                const quint32* s2 = row(src, srcStride, y + 2);
+                const quint32* s3 = row(src, srcStride, y + 3);
+                int x = tx;
+                for (; x + 4 <= xe; x += 4) {
+                    transpose4x4(s0 + x, s1 + x, s2 + x, s3 + x,
+                                 row(dst, dstStride, width - 1 - x) + y, row(dst, dstStride, width - 2 - x) + y,
+                                 row(dst, dstStride, width - 3 - x) + y, row(dst, dstStride, width - 4 - x) + y);
+                }
+                for (; x < xe; ++x) {
+                    quint32* d = row(dst, dstStride, width - 1 - x) + y;
+                    d[0] = s0[x]; d[1] = s1[x]; d[2] = s2[x]; d[3] = s3[x];
+                }
+            }
+            for (; y < ye; ++y) {
+                const quint32* s = row(src, srcStride, y);
+                for (int x = tx; x < xe; ++x) {
+                    row(dst, dstStride, width - 1 - x)[y] = s[x];
+                }
+            }
+        }
+    }
+}
+
+// dst (width x height): dst(width - 1 - x, height - 1 - y) = src(x, y)
+inline void rotate180(const uchar* src, int srcStride, int width, int height, uchar* dst, int dstStride) {
+    for (int y = 0; y < height; ++y) {
+        const quint32* s = row(src, srcStride, y);
+        quint32* d = row(dst, dstStride, height - 1 - y);
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            reverse4(s + x, d + width - 4 - x);
+        }
+        for (; x < width; ++x) {
+            d[width - 1 - x] = s[x];
+        }
+    }
+}
+
+}
+
+#endif // IMAGETRANSPOSE_H
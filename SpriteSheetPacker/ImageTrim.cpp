@@ -0,0 +1,146 @@
+#include "ImageTrim.h"
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#   define TRIM_AVX2
+#   define TRIM_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#   include <emmintrin.h>
+#   define TRIM_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#   include <arm_neon.h>
+#   define TRIM_NEON
+#endif
+
+// SIMD loops only find the block with the first hit, the scalar loop finds the exact pixel inside it.
+
+static int findFirstOpaque(const quint32* line, int begin, int end, int alpha) {
+    int x = begin;
+#if defined(TRIM_AVX2)
+    const __m256i threshold8 = _mm256_set1_epi32(alpha - 1);
+    for (; x + 8 <= end; x += 8) {
+        __m256i a = _mm256_srli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(line + x)), 24);
+        if (_mm256_movemask_epi8(_mm256_cmpgt_epi32(a, threshold8))) break;
+    }
+#endif
+#if defined(TRIM_SSE2)
+    const __m128i threshold4 = _mm_set1_epi32(alpha - 1);
+    for (; x + 4 <= end; x += 4) {
+        __m128i a = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(line + x)), 24);
+        if (_mm_movemask_epi8(_mm_cmpgt_epi32(a, threshold4))) break;
+    }
+#elif defined(TRIM_NEON)
+    const uint32x4_t threshold4 = vdupq_n_u32(alpha);
+    for (; x + 4 <= end; x += 4) {
+        uint32x4_t a = vshrq_n_u32(vld1q_u32(line + x), 24);
+        uint64x2_t m = vreinterpretq_u64_u32(vcgeq_u32(a, threshold4));
+        if (vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1)) break;
+    }
+#endif
+    for (; x < end; ++x) {
+        if ((int)(line[x] >> 24) >= alpha) return x;
+    }
+    return -1;
+}
+
+static int findLastOpaque(const quint32* line, int begin, int end, int alpha) {
+    int x = end;
+#if defined(TRIM_AVX2)
+    const __m256i threshold8 = _mm256_set1_epi32(alpha - 1);
+    for (; x - 8 >= begin; x -= 8) {
+        __m256i a = _mm256_srli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(line + x - 8)), 24);
+        if (_mm256_movemask_epi8(_mm256_cmpgt_epi32(a, threshold8))) break;
+    }
+#endif
+#if defined(TRIM_SSE2)
+    const __m128i threshold4 = _mm_set1_epi32(alpha - 1);
+    for (; x - 4 >= begin; x -= 4) {
+        __m128i a = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(line + x - 4)), 24);
+        if (_mm_movemask_epi8(_mm_cmpgt_epi32(a, threshold4))) break;
+    }
+#elif defined(TRIM_NEON)
+    const uint32x4_t threshold4 = vdupq_n_u32(alpha);
+    for (; x - 4 >= begin; x -= 4) {
+        uint32x4_t a = vshrq_n_u32(vld1q_u32(line + x - 4), 24);
+        uint64x2_t m = vreinterpretq_u64_u32(vcgeq_u32(a, threshold4));
+        if (vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1)) break;
+    }
+#endif
+    for (--x; x >= begin; --x) {
+        if ((int)(line[x] >> 24) >= alpha) return x;
+    }
+    return -1;
+}
+
+static bool hasAlphaInHighByte(QImage::Format format) {
+    if ((format == QImage::Format_ARGB32) || (format == QImage::Format_ARGB32_Premultiplied)) {
+        return true;
+    }
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    if ((format == QImage::Format_RGBA8888) || (format == QImage::Format_RGBA8888_Premultiplied)) {
+        return true;
+    }
+#endif
+    return false;
+}
+
+void alphaBounds(const QImage& image, int alpha, int& left, int& top, int& right, int& bottom) {
+    const int width = image.width();
+    const int height = image.height();
+    left = width;
+    top = height;
+    right = 0;
+    bottom = 0;
+
+    if (!hasAlphaInHighByte(image.format())) {
+        for (int y=0; y<height; y++) {
+            bool rowFilled = false;
+            for (int x=0; x<width; x++) {
+                if (qAlpha(image.pixel(x, y)) >= alpha) {
+                    rowFilled = true;
+                    right = qMax(right, x);
+                    left = qMin(left, x);
+                }
+            }
+            if (rowFilled) {
+                top = qMin(top, y);
+                bottom = y;
+            }
+        }
+        return;
+    }
+
+    alpha = qMax(alpha, 0);
+    auto line = [&image](int y) { return reinterpret_cast<const quint32*>(image.constScanLine(y)); };
+
+    // top row, it also gives the first guess for left and right
+    int y = 0;
+    int l = -1;
+    for (; y < height; ++y) {
+        l = findFirstOpaque(line(y), 0, width, alpha);
+        if (l >= 0) break;
+    }
+    if (l < 0) return;
+    top = y;
+    left = l;
+    right = findLastOpaque(line(y), l, width, alpha);
+
+    // bottom row
+    for (y = height - 1; y > top; --y) {
+        if (findFirstOpaque(line(y), 0, width, alpha) >= 0) break;
+    }
+    bottom = y;
+
+    // left and right columns, only the pixels outside of the current bounds are scanned
+    for (y = top + 1; (y <= bottom) && ((left > 0) || (right < width - 1)); ++y) {
+        const quint32* scanLine = line(y);
+        if (left > 0) {
+            int x = findFirstOpaque(scanLine, 0, left, alpha);
+            if (x >= 0) left = x;
+        }
+        if (right < width - 1) {
+            int x = findLastOpaque(scanLine, right + 1, width, alpha);
+            if (x >= 0) right = x;
+        }
+    }
+}
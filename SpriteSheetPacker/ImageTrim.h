@@ -0,0 +1,13 @@
+#ifndef IMAGETRIM_H
+#define IMAGETRIM_H
+
+#include <QImage>
+
+// Finds the bounds of all pixels with alpha >= threshold.
+// ARGB32, ARGB32_Premultiplied and RGBA8888 (little endian) scanlines are scanned with SSE2/AVX2/NEON,
+// rows from the top and bottom, columns from the left and right, stopping as soon as the bounds are known.
+// Any other format falls back to QImage::pixel().
+// If nothing is found, left/top are the image width/height and right/bottom are 0.
+void alphaBounds(const QImage& image, int alpha, int& left, int& top, int& right, int& bottom);
+
+#endif // IMAGETRIM_H
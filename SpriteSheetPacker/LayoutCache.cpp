@@ -0,0 +1,124 @@
+#include "LayoutCache.h"
+
+static const quint32 kCacheMagic = 0x53534c43; // SSLC
+static const quint32 kCacheVersion = 2;
+static const int kMaxEntries = 64;
+
+// key -> (save time, entry)
+typedef QMap<QString, QPair<qint64, QByteArray> > CacheEntries;
+
+static QDataStream& operator << (QDataStream& stream, const LayoutCache::Rect& rect) {
+    return stream << (qint32)rect.index << (qint32)rect.x << (qint32)rect.y << (qint32)rect.w << (qint32)rect.h << rect.rotated;
+}
+
+static QDataStream& operator >> (QDataStream& stream, LayoutCache::Rect& rect) {
+    qint32 index, x, y, w, h;
+    stream >> index >> x >> y >> w >> h >> rect.rotated;
+    rect.index = index;
+    rect.x = x;
+    rect.y = y;
+    rect.w = w;
+    rect.h = h;
+    return stream;
+}
+
+static bool readEntries(const QString& fileName, CacheEntries& entries) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    quint32 magic, version;
+    stream >> magic >> version;
+    if ((magic != kCacheMagic) || (version != kCacheVersion)) {
+        return false;
+    }
+
+    stream >> entries;
+    return stream.status() == QDataStream::Ok;
+}
+
+QString LayoutCache::key(const QStringList& names, const Settings& settings) {
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << kCacheVersion
+           << settings.algorithm
+           << settings.rotateSprites
+           << settings.pow2
+           << settings.forceSquared
+           << settings.maxTextureSize
+           << settings.textureBorder
+           << settings.spriteBorder
+           << settings.scale
+           << settings.fixedSize
+           << names;
+
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+}
+
+QString LayoutCache::stableKey(int page, const Settings& settings) {
+    return key(QStringList() << QString("stable:%1").arg(page), settings);
+}
+
+bool LayoutCache::load(const QString& fileName, const QString& key, Entry& entry) {
+    CacheEntries entries;
+    if (!readEntries(fileName, entries) || !entries.contains(key)) {
+        return false;
+    }
+
+    QDataStream stream(entries[key].second);
+    qint32 width, height;
+    stream >> entry.algorithm >> width >> height >> entry.names >> entry.sizes >> entry.placed >> entry.remainder >> entry.packedWaste;
+    entry.width = width;
+    entry.height = height;
+
+    return stream.status() == QDataStream::Ok;
+}
+
+bool LayoutCache::save(const QString& fileName, const QString& key, const Entry& entry) {
+    // the scaling variants are built in parallel and share the file
+    QLockFile lock(fileName + ".lock");
+    if (!lock.tryLock(5000)) {
+        return false;
+    }
+
+    CacheEntries entries;
+    readEntries(fileName, entries);
+
+    QByteArray data;
+    QDataStream entryStream(&data, QIODevice::WriteOnly);
+    entryStream << entry.algorithm << (qint32)entry.width << (qint32)entry.height << entry.names << entry.sizes << entry.placed << entry.remainder << entry.packedWaste;
+    entries[key] = qMakePair(QDateTime::currentMSecsSinceEpoch(), data);
+
+    // drop the oldest entries, e.g. of renamed sprites or changed settings
+    while (entries.size() > kMaxEntries) {
+        auto oldest = entries.begin();
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it.value().first < oldest.value().first) oldest = it;
+        }
+        entries.erase(oldest);
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream << kCacheMagic << kCacheVersion << entries;
+
+    return file.commit();
+}
+
+QString LayoutCache::fileName(const QString& projectFileName) {
+    if (projectFileName.isEmpty()) return QString();
+
+    QFileInfo fi(projectFileName);
+    return fi.absolutePath() + "/" + fi.completeBaseName() + ".layoutcache";
+}
+
+bool LayoutCache::isEnabled() {
+    QSettings settings;
+    return settings.value("Preferences/layoutCache", true).toBool();
+}
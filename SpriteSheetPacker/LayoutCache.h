@@ -0,0 +1,59 @@
+#ifndef LAYOUTCACHE_H
+#define LAYOUTCACHE_H
+
+#include <QtCore>
+
+// Rect layouts of the previous builds, kept in one file next to the project.
+// An entry is keyed by the pack settings and the sprite names of one atlas page and stores the sprite sizes it was
+// made for, so a rebuild with unchanged sizes reuses the layout verbatim and a rebuild with changed sizes starts
+// the size search from the cached atlas size.
+class LayoutCache
+{
+public:
+    struct Settings {
+        QString algorithm;
+        bool    rotateSprites;
+        bool    pow2;
+        bool    forceSquared;
+        int     maxTextureSize;
+        int     textureBorder;
+        int     spriteBorder;
+        float   scale;
+        bool    fixedSize;
+    };
+
+    struct Rect {
+        int  index;     // sprite index in the page content
+        int  x;
+        int  y;
+        int  w;
+        int  h;
+        bool rotated;
+    };
+
+    struct Entry {
+        QString algorithm;
+        int width;
+        int height;
+        QStringList names;      // sprite names in the page content order
+        QVector<QSize> sizes;   // packed sprite sizes in the page content order
+        QVector<Rect> placed;
+        QVector<Rect> remainder;
+        float packedWaste;      // free area share of the last full repack, the stable layout baseline
+    };
+
+    static QString key(const QStringList& names, const Settings& settings);
+    // stable layout of the atlas page, independent of the sprite set
+    static QString stableKey(int page, const Settings& settings);
+
+    static bool load(const QString& fileName, const QString& key, Entry& entry);
+    static bool save(const QString& fileName, const QString& key, const Entry& entry);
+
+    // cache file of the project
+    static QString fileName(const QString& projectFileName);
+
+    // user preferences
+    static bool isEnabled();
+};
+
+#endif // LAYOUTCACHE_H
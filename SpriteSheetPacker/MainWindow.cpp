@@ -11,6 +11,8 @@
 #include "AnimationDialog.h"
 #include "ContentProtectionDialog.h"
 #include "UpdaterDialog.h"
+#include "SourceImageStore.h"
+#include "LayoutCache.h"
 #include "ui_MainWindow.h"
 
 #include "PListParser.h"
@@ -37,6 +39,8 @@ MainWindow::MainWindow(QWidget *parent) :
 
     _blockUISignals = false;
     _projectDirty = false;
+    _polygonStep = 5;
+    _polygonCandidates = 0;
 
     _spritesTreeWidget = new SpritesTreeWidget(ui->spritesDockWidgetContents);
     connect(_spritesTreeWidget, SIGNAL(itemSelectionChanged()), this, SLOT(spritesTreeWidgetItemSelectionChanged()));
@@ -87,6 +91,7 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->pngOptLevelSlider->setVisible(false);
     ui->pngOptLevelText->setVisible(false);
     ui->pngOptLevelLabel->setVisible(false);
+    ui->pngSharedPaletteCheckBox->setVisible(false);
 
     // layout preferences action on right side in toolbar
     QWidget* empty = new QWidget();
@@ -232,6 +237,9 @@ void MainWindow::refreshAtlas(bool generate) {
         _future = QtConcurrent::run([this]() {
             _mutex.lock();
             _spriteAtlas.clear();
+            QSharedPointer<SourceImageStore> sourceStore(new SourceImageStore());
+            QVector<SpriteAtlas> atlases;
+            QVector<SpriteAtlasGenerateProgress*> progress;
             for (int i=0; i<ui->scalingVariantsGroupBox->layout()->count(); ++i) {
                 ScalingVariantWidget* scalingVariantWidget = qobject_cast<ScalingVariantWidget*>(ui->scalingVariantsGroupBox->layout()->itemAt(i)->widget());
                 if (scalingVariantWidget) {
@@ -252,29 +260,53 @@ void MainWindow::refreshAtlas(bool generate) {
 
                     atlas.setRotateSprites(ui->rotateSpritesCheckBox->isChecked());
                     atlas.setAlgorithm(ui->algorithmComboBox->currentText());
+                    atlas.setSearchTimeLimit(ui->searchTimeSpinBox->value() * 1000);
+                    atlas.setSourceStore(sourceStore);
+                    if (LayoutCache::isEnabled()) {
+                        atlas.setLayoutCache(LayoutCache::fileName(_currentProjectFileName));
+                    }
+                    atlas.setStableLayout(ui->stableLayoutCheckBox->isChecked());
+                    atlas.setMultiPage(ui->balancePagesCheckBox->isChecked(), ui->fixedPageSizeCheckBox->isChecked());
 
                     if (ui->trimModeComboBox->currentText() == "Polygon") {
                         atlas.enablePolygonMode(true, ui->epsilonHorizontalSlider->value() / 10.f);
+                        atlas.setPolygonSearch(_polygonStep, _polygonCandidates);
                     }
+                    atlases.push_back(atlas);
 
-                    SpriteAtlasGenerateProgress* progress = new SpriteAtlasGenerateProgress();
-                    connect(progress, SIGNAL(progressTextChanged(const QString&)), this, SLOT(onRefreshAtlasProgressTextChanged(const QString&)));
-
-                    auto connection = connect(this, &MainWindow::abortRefreshAtlas, [&atlas]() {
-                        atlas.abortGeneration();
+                    // the variants run at once, so every message tells its variant
+                    QString prefix = QString().number(scale*100) + "%: ";
+                    SpriteAtlasGenerateProgress* atlasProgress = new SpriteAtlasGenerateProgress();
+                    connect(atlasProgress, &SpriteAtlasGenerateProgress::progressTextChanged, this, [this, prefix](const QString& message) {
+                        onRefreshAtlasProgressTextChanged(prefix + message);
                     });
+                    progress.push_back(atlasProgress);
+                }
+            }
 
-                    if (!atlas.generate(progress)) {
-                        disconnect(connection);
-                        delete progress;
-                        _mutex.unlock();
-                        return false;
-                    } else {
-                        _spriteAtlas.push_back(atlas);
-                    }
-                    disconnect(connection);
-                    delete progress;
+            sourceStore->setConsumers(atlases.size());
+
+            QAtomicInt aborted(0);
+            auto connection = connect(this, &MainWindow::abortRefreshAtlas, [&atlases, &aborted]() {
+                aborted.store(1);
+                for (SpriteAtlas& atlas: atlases) {
+                    atlas.abortGeneration();
                 }
+            });
+
+            QVector<bool> results = SpriteAtlas::generateVariants(atlases, SpriteAtlas::variantThreads(), progress, [&aborted]() -> bool {
+                return aborted.load();
+            });
+
+            disconnect(connection);
+            qDeleteAll(progress);
+
+            if (aborted.load() || results.contains(false)) {
+                _mutex.unlock();
+                return false;
+            }
+            for (const SpriteAtlas& atlas: atlases) {
+                _spriteAtlas.push_back(atlas);
             }
             _atlasDirty = false;
             _mutex.unlock();
@@ -342,11 +374,15 @@ void MainWindow::openSpritePackerProject(const QString& fileName) {
 
     _blockUISignals = true;
     ui->algorithmComboBox->setCurrentText(projectFile->algorithm());
+    ui->searchTimeSpinBox->setValue(projectFile->searchTime());
     ui->trimModeComboBox->setCurrentText(projectFile->trimMode());
     ui->trimSpinBox->setValue(projectFile->trimThreshold());
     ui->epsilonHorizontalSlider->setValue(projectFile->epsilon() * 10);
     ui->heuristicMaskCheckBox->setChecked(projectFile->heuristicMask());
     ui->rotateSpritesCheckBox->setChecked(projectFile->rotateSprites());
+    ui->stableLayoutCheckBox->setChecked(projectFile->stableLayout());
+    ui->balancePagesCheckBox->setChecked(projectFile->balancePages());
+    ui->fixedPageSizeCheckBox->setChecked(projectFile->fixedPageSize());
     ui->textureBorderSpinBox->setValue(projectFile->textureBorder());
     ui->spriteBorderSpinBox->setValue(projectFile->spriteBorder());
     ui->dataFormatComboBox->setCurrentText(projectFile->dataFormat());
@@ -357,6 +393,7 @@ void MainWindow::openSpritePackerProject(const QString& fileName) {
     ui->premultipliedCheckBox->setChecked(projectFile->premultiplied());
     ui->pngOptModeComboBox->setCurrentText(projectFile->pngOptMode());
     ui->pngOptLevelSlider->setValue(projectFile->pngOptLevel());
+    ui->pngSharedPaletteCheckBox->setChecked(projectFile->pngSharedPalette());
     ui->webpQualitySlider->setValue(projectFile->webpQuality());
     ui->jpgQualitySlider->setValue(projectFile->jpgQuality());
 
@@ -364,6 +401,8 @@ void MainWindow::openSpritePackerProject(const QString& fileName) {
     ui->prependSmartFolderNameCheckBox->setChecked(projectFile->prependSmartFolderName());
 
     _encryptionKey = projectFile->encryptionKey();
+    _polygonStep = projectFile->polygonStep();
+    _polygonCandidates = projectFile->polygonCandidates();
     ui->contentProtectionToolButton->setChecked(!_encryptionKey.isEmpty());
 
     while(ui->scalingVariantsGroupBox->layout()->count() > 0){
@@ -418,11 +457,15 @@ void MainWindow::saveSpritePackerProject(const QString& fileName) {
     }
 
     projectFile->setAlgorithm(ui->algorithmComboBox->currentText());
+    projectFile->setSearchTime(ui->searchTimeSpinBox->value());
     projectFile->setTrimMode(ui->trimModeComboBox->currentText());
     projectFile->setTrimThreshold(ui->trimSpinBox->value());
     projectFile->setEpsilon(ui->epsilonHorizontalSlider->value() / 10.f);
     projectFile->setHeuristicMask(ui->heuristicMaskCheckBox->isChecked());
     projectFile->setRotateSprites(ui->rotateSpritesCheckBox->isChecked());
+    projectFile->setStableLayout(ui->stableLayoutCheckBox->isChecked());
+    projectFile->setBalancePages(ui->balancePagesCheckBox->isChecked());
+    projectFile->setFixedPageSize(ui->fixedPageSizeCheckBox->isChecked());
     projectFile->setTextureBorder(ui->textureBorderSpinBox->value());
     projectFile->setSpriteBorder(ui->spriteBorderSpinBox->value());
     projectFile->setDataFormat(ui->dataFormatComboBox->currentText());
@@ -433,11 +476,14 @@ void MainWindow::saveSpritePackerProject(const QString& fileName) {
     projectFile->setPremultiplied(ui->premultipliedCheckBox->isChecked());
     projectFile->setPngOptMode(ui->pngOptModeComboBox->currentText());
     projectFile->setPngOptLevel(ui->pngOptLevelSlider->value());
+    projectFile->setPngSharedPalette(ui->pngSharedPaletteCheckBox->isChecked());
     projectFile->setWebpQuality(ui->webpQualitySlider->value());
     projectFile->setJpgQuality(ui->jpgQualitySlider->value());
     projectFile->setTrimSpriteNames(ui->trimSpriteNamesCheckBox->isChecked());
     projectFile->setPrependSmartFolderName(ui->prependSmartFolderNameCheckBox->isChecked());
     projectFile->setEncryptionKey(_encryptionKey);
+    projectFile->setPolygonStep(_polygonStep);
+    projectFile->setPolygonCandidates(_polygonCandidates);
 
     QVector<ScalingVariant> scalingVariants;
     for (int i=0; i<ui->scalingVariantsGroupBox->layout()->count(); ++i) {
@@ -649,11 +695,17 @@ void MainWindow::on_actionPublish_triggered() {
         return;
     }
 
+    // the previous publish may still optimize the same png files
+    if (_optimizingPublisher) {
+        _optimizingPublisher->waitForOptimizePNG();
+    }
+
     PublishSpriteSheet* publisher = new PublishSpriteSheet();
     publisher->setImageFormat(imageFormatFromString(ui->imageFormatComboBox->currentText()));
     publisher->setPixelFormat(pixelFormatFromString(ui->pixelFormatComboBox->currentText()));
     publisher->setPremultiplied(ui->premultipliedCheckBox->isChecked());
     publisher->setPngQuality(ui->pngOptModeComboBox->currentText(), ui->pngOptLevelSlider->value());
+    publisher->setPngSharedPalette(ui->pngSharedPaletteCheckBox->isChecked());
     publisher->setWebpQuality(ui->webpQualitySlider->value());
     publisher->setJpgQuality(ui->jpgQualitySlider->value());
     publisher->setTrimSpriteNames(ui->trimSpriteNamesCheckBox->isChecked());
@@ -668,6 +720,9 @@ void MainWindow::on_actionPublish_triggered() {
     if (_atlasDirty) {
         _spriteAtlas.clear();
     }
+    QSharedPointer<SourceImageStore> sourceStore(new SourceImageStore());
+    QVector<SpriteAtlas> atlases;
+    QStringList atlasFilePaths;
     for (int i=0; i<ui->scalingVariantsGroupBox->layout()->count(); ++i) {
         ScalingVariantWidget* scalingVariantWidget = qobject_cast<ScalingVariantWidget*>(ui->scalingVariantsGroupBox->layout()->itemAt(i)->widget());
         if (scalingVariantWidget) {
@@ -712,38 +767,62 @@ void MainWindow::on_actionPublish_triggered() {
                                   scale);
 
                 atlas.setAlgorithm(ui->algorithmComboBox->currentText());
+                atlas.setSearchTimeLimit(ui->searchTimeSpinBox->value() * 1000);
+                atlas.setSourceStore(sourceStore);
+                if (LayoutCache::isEnabled()) {
+                    atlas.setLayoutCache(LayoutCache::fileName(_currentProjectFileName));
+                }
+                atlas.setStableLayout(ui->stableLayoutCheckBox->isChecked());
+                atlas.setMultiPage(ui->balancePagesCheckBox->isChecked(), ui->fixedPageSizeCheckBox->isChecked());
 
                 if (ui->trimModeComboBox->currentText() == "Polygon") {
                     atlas.enablePolygonMode(true, ui->epsilonHorizontalSlider->value() / 10.f);
+                    atlas.setPolygonSearch(_polygonStep, _polygonCandidates);
                 }
 
-                if (!atlas.generate()) {
-                    QMessageBox::critical(this, "Generate error", "Max texture size limit is small!");
-                    publishStatusDialog.log("Generate error: Max texture size limit is small!", Qt::red);
-                    continue;
-                } else {
-                    _spriteAtlas.push_back(atlas);
-                }
+                atlases.push_back(atlas);
+                atlasFilePaths.push_back(destFileInfo.filePath());
+            }
+        }
+    }
 
-                publisher->addSpriteSheet(atlas, destFileInfo.filePath());
+    if (!atlases.isEmpty()) {
+        sourceStore->setConsumers(atlases.size());
+        QVector<bool> results = SpriteAtlas::generateVariants(atlases, SpriteAtlas::variantThreads());
+        for (int i=0; i<atlases.size(); ++i) {
+            if (!results[i]) {
+                QMessageBox::critical(this, "Generate error", "Max texture size limit is small!");
+                publishStatusDialog.log("Generate error: Max texture size limit is small!", Qt::red);
+                continue;
             }
+            _spriteAtlas.push_back(atlases[i]);
+            publisher->addSpriteSheet(atlases[i], atlasFilePaths[i]);
         }
         refreshAtlas(false);
     }
 
+    if (ui->pngOptModeComboBox->currentText() != "None") {
+        // connected before publishing, the first files may be optimized before it returns
+        QObject::connect(publisher, &PublishSpriteSheet::onOptimizedPNG, &publishStatusDialog, [&publishStatusDialog] (const QString& fileName, qint64 rawSize, qint64 fileSize, qint64 elapsed, int completed, int count) {
+            publishStatusDialog.log(QString("PNG Optimization (%1/%2): %3 %4 KB of pixels -> %5 KB in %6 ms")
+                                    .arg(completed).arg(count).arg(QFileInfo(fileName).fileName())
+                                    .arg(rawSize / 1024).arg(fileSize / 1024).arg(elapsed));
+        });
+        QObject::connect(publisher, &PublishSpriteSheet::onCompletedOptimizePNG, this, [this, publisher] (qint64 rawSize, qint64 fileSize, qint64 elapsed) {
+            QMessageBox::information(this, "PNG Optimization", QString("PNG Optimization: complete.\n%1 KB of pixels -> %2 KB in %3 s")
+                                     .arg(rawSize / 1024).arg(fileSize / 1024).arg(elapsed / 1000.0, 0, 'f', 1));
+            publisher->deleteLater();
+        });
+    }
+
     publishStatusDialog.log("Publish data and images...", Qt::darkGreen);
     publisher->publish(ui->dataFormatComboBox->currentText());
 
-    if (ui->pngOptModeComboBox->currentText() == "None") {
+    if (!publisher->optimizePNGCount()) {
         delete publisher;
     } else {
+        _optimizingPublisher = publisher;
         publishStatusDialog.log("PNG Optimization: optimize if needed.");
-        // TODO: you need to wait previous image optimization if they are the same
-        QObject::connect(publisher, &PublishSpriteSheet::onCompletedOptimizePNG, [this, publisher] () {
-            // TODO: it would be good to show here for information about the optimization
-            QMessageBox::information(this, "PNG Optimization", "PNG Optimization: complete.");
-            delete publisher;
-        });
     }
 
     publishStatusDialog.log(QString("Publishing is finished."), Qt::blue);
@@ -871,12 +950,17 @@ void MainWindow::on_addScalingVariantPushButton_clicked() {
 }
 
 void MainWindow::on_pngOptModeComboBox_currentTextChanged(const QString &text) {
-    bool visible = (text == "Lossless");
+    bool visible = (text == "Lossless") || (text == "Lossy");
 
     ui->pngOptLevelSlider->setVisible(visible);
     ui->pngOptLevelText->setVisible(visible);
     ui->pngOptLevelLabel->setVisible(visible);
+    ui->pngSharedPaletteCheckBox->setVisible(text == "Lossy");
+
+    setProjectDirty();
+}
 
+void MainWindow::on_pngSharedPaletteCheckBox_toggled() {
     setProjectDirty();
 }
 
@@ -917,11 +1001,32 @@ void MainWindow::on_rotateSpritesCheckBox_toggled() {
     setProjectDirty();
 }
 
+void MainWindow::on_stableLayoutCheckBox_toggled() {
+    propertiesValueChanged();
+    setProjectDirty();
+}
+
+void MainWindow::on_balancePagesCheckBox_toggled() {
+    propertiesValueChanged();
+    setProjectDirty();
+}
+
+void MainWindow::on_fixedPageSizeCheckBox_toggled() {
+    propertiesValueChanged();
+    setProjectDirty();
+}
+
 void MainWindow::on_algorithmComboBox_currentTextChanged(const QString& text) {
     if (text == "Polygon") {
         ui->trimModeComboBox->setCurrentText("Polygon");
     }
+    ui->searchTimeSpinBox->setEnabled(text == "Best");
+
+    propertiesValueChanged();
+    setProjectDirty();
+}
 
+void MainWindow::on_searchTimeSpinBox_valueChanged(double) {
     propertiesValueChanged();
     setProjectDirty();
 }
@@ -14,6 +14,8 @@ namespace Ui {
 class MainWindow;
 }
 
+class PublishSpriteSheet;
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -65,12 +67,16 @@ private slots:
     void on_addScalingVariantPushButton_clicked();
 
     void on_algorithmComboBox_currentTextChanged(const QString& text);
+    void on_searchTimeSpinBox_valueChanged(double value);
     void on_trimModeComboBox_currentIndexChanged(int value);
     void on_trimSpinBox_valueChanged(int value);
     void on_epsilonHorizontalSlider_sliderMoved(int value);
     void on_epsilonHorizontalSlider_sliderReleased();
     void on_heuristicMaskCheckBox_toggled();
     void on_rotateSpritesCheckBox_toggled();
+    void on_stableLayoutCheckBox_toggled();
+    void on_balancePagesCheckBox_toggled();
+    void on_fixedPageSizeCheckBox_toggled();
     void on_textureBorderSpinBox_valueChanged(int value);
     void on_spriteBorderSpinBox_valueChanged(int value);
     void on_imageFormatComboBox_currentIndexChanged(int index);
@@ -79,6 +85,7 @@ private slots:
     void on_destPathLineEdit_textChanged(const QString& text);
     void on_spriteSheetLineEdit_textChanged(const QString& text);
     void on_pngOptModeComboBox_currentTextChanged(const QString &text);
+    void on_pngSharedPaletteCheckBox_toggled();
     void on_premultipliedCheckBox_toggled();
 
     void onScalingVariantWidgetValueChanged(bool);
@@ -107,6 +114,11 @@ private:
     bool                    _needFitAfterRefresh;
     bool                    _epsilonValueChanged;
     QString                 _encryptionKey;
+    int                     _polygonStep;
+    int                     _polygonCandidates;
+
+    // publisher of the last publish while its png optimization runs
+    QPointer<PublishSpriteSheet> _optimizingPublisher;
 
     QFuture<bool>           _future;
     QFutureWatcher<bool>    _watcher;
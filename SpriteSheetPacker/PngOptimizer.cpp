@@ -3,9 +3,11 @@
 #include <QtCore>
 #include "lodepng.h"
 #include <QImage>
+#include <QtConcurrent>
 
-OptiPngOptimizer::OptiPngOptimizer(int optLevel) {
+OptiPngOptimizer::OptiPngOptimizer(int optLevel, int threads) {
     _optLevel = optLevel;
+    _threads = threads;
 
     memset(&options, 0, sizeof(options));
 
@@ -18,6 +20,8 @@ OptiPngOptimizer::OptiPngOptimizer(int optLevel) {
     opng_set_options(optimizer, &options);
 
     opng_set_transformer(optimizer, transformer);
+
+    opng_set_trial_runner(optimizer, (_threads != 1)? &OptiPngOptimizer::runTrials : NULL, this);
 }
 
 OptiPngOptimizer::~OptiPngOptimizer() {
@@ -48,6 +52,22 @@ bool OptiPngOptimizer::optimizeFile(const QString& fileName) {
     return true;
 }
 
+bool OptiPngOptimizer::optimizeImage(const QImage& image, const QString& fileName) {
+    // no copy when the image is already in the atlas format
+    QImage rgba = image.convertToFormat(QImage::Format_RGBA8888);
+
+    if (opng_optimize_rgba(optimizer,
+                           rgba.constBits(),
+                           rgba.width(),
+                           rgba.height(),
+                           rgba.bytesPerLine(),
+                           fileName.toStdString().c_str()) != 0) {
+        return false;
+    }
+
+    return true;
+}
+
 bool OptiPngOptimizer::setOptions(int optLevel) {
     _optLevel = optLevel;
 
@@ -60,24 +80,44 @@ bool OptiPngOptimizer::setOptions(int optLevel) {
     return true;
 }
 
-PngQuantOptimizer::PngQuantOptimizer(int optLevel) {
-    _optLevel = optLevel;
+void OptiPngOptimizer::setThreads(int threads) {
+    _threads = threads;
 
-    attr = liq_attr_create();
+    opng_set_trial_runner(optimizer, (_threads != 1)? &OptiPngOptimizer::runTrials : NULL, this);
 }
 
-PngQuantOptimizer::~PngQuantOptimizer() {
-    liq_attr_destroy(attr);
+int OptiPngOptimizer::trialThreads() {
+    QSettings settings;
+    return settings.value("Preferences/pngTrialThreads", 0).toInt();
+}
 
-    if (image) {
-        liq_image_destroy(image);
+void OptiPngOptimizer::runTrials(void (*trial)(void*, int), void* trialArg, int count, void* userArg) {
+    OptiPngOptimizer* self = static_cast<OptiPngOptimizer*>(userArg);
+
+    // started in the trial order: the first trials give the size limit that stops the others early
+    QThreadPool pool;
+    pool.setMaxThreadCount(self->_threads? self->_threads : QThread::idealThreadCount());
+    QVector<QFuture<void>> futures;
+    for (int i = 0; i < count; ++i) {
+        futures.push_back(QtConcurrent::run(&pool, [trial, trialArg, i]() {
+            trial(trialArg, i);
+        }));
     }
-
-    if (res) {
-        liq_result_destroy(res);
+    for (QFuture<void>& future: futures) {
+        future.waitForFinished();
     }
 }
 
+PngQuantOptimizer::PngQuantOptimizer(int optLevel) {
+    attr = liq_attr_create();
+
+    setOptions(optLevel);
+}
+
+PngQuantOptimizer::~PngQuantOptimizer() {
+    liq_attr_destroy(attr);
+}
+
 bool PngQuantOptimizer::optimizeFiles(const QStringList& fileNames) {
 
     for(const QString& fileName : fileNames) {
@@ -90,29 +130,91 @@ bool PngQuantOptimizer::optimizeFiles(const QStringList& fileNames) {
 }
 
 bool PngQuantOptimizer::optimizeFile(const QString& fileName) {
-    unsigned int width, height = 0;
-    unsigned char *compressed = NULL;
-    size_t compressed_size = 0;
+    return optimizeImage(QImage(fileName), fileName);
+}
 
-    QImage img(fileName);
-    img = img.convertToFormat(QImage::Format_RGBA8888);
+bool PngQuantOptimizer::optimizeImage(const QImage& source, const QString& fileName) {
+    const QImage img = source.convertToFormat(QImage::Format_RGBA8888);
 
-    width = img.width();
-    height = img.height();
+    liq_image* image = liq_image_create_rgba(attr, img.constBits(), img.width(), img.height(), 0);
+    if (!image) return false;
 
-    LodePNGState state;
-    lodepng_state_init(&state);
+    liq_result* res = nullptr;
+    bool result = (liq_image_quantize(image, attr, &res) == LIQ_OK) && writeImage(res, image, fileName);
 
-    image = liq_image_create_rgba(attr, img.bits(), width, height, 0);
-    liq_set_speed(attr, 1);
+    if (res) {
+        liq_result_destroy(res);
+    }
+    liq_image_destroy(image);
 
-    res = liq_quantize_image(attr, image);
+    return result;
+}
 
-    if (!res) return false;
+bool PngQuantOptimizer::optimizeImages(const QVector<QImage>& sources, const QStringList& fileNames) {
+    // the converted images hold the pixels of the liq images till the end
+    QVector<QImage> imgs;
+    QVector<liq_image*> images;
+    imgs.reserve(sources.size());
+    images.reserve(sources.size());
+
+    liq_histogram* hist = liq_histogram_create(attr);
+    bool result = (hist != nullptr);
+    for (int i = 0; result && (i < sources.size()); ++i) {
+        imgs.push_back(sources[i].convertToFormat(QImage::Format_RGBA8888));
+        liq_image* image = liq_image_create_rgba(attr, imgs.back().constBits(), imgs.back().width(), imgs.back().height(), 0);
+        if (!image) {
+            result = false;
+            break;
+        }
+        images.push_back(image);
+        result = (liq_histogram_add_image(hist, attr, image) == LIQ_OK);
+    }
+
+    liq_result* res = nullptr;
+    if (result) {
+        result = (liq_histogram_quantize(hist, attr, &res) == LIQ_OK);
+    }
+    for (int i = 0; result && (i < images.size()); ++i) {
+        result = writeImage(res, images[i], fileNames[i]);
+    }
+
+    if (res) {
+        liq_result_destroy(res);
+    }
+    for (liq_image* image : images) {
+        liq_image_destroy(image);
+    }
+    if (hist) {
+        liq_histogram_destroy(hist);
+    }
+
+    return result;
+}
+
+bool PngQuantOptimizer::setOptions(int optLevel) {
+    _optLevel = optLevel;
+
+    // levels 0-6 run libimagequant from speed 7 (a rough palette, several times faster) to 1 (the best palette)
+    if (liq_set_speed(attr, qBound(1, 7 - _optLevel, 10)) != LIQ_OK) {
+        return false;
+    }
+    // and aim from quality 70 to 100, the minimum 0 never fails the quantization
+    if (liq_set_quality(attr, 0, qBound(70, 70 + _optLevel * 5, 100)) != LIQ_OK) {
+        return false;
+    }
+
+    return true;
+}
+
+bool PngQuantOptimizer::writeImage(liq_result* res, liq_image* image, const QString& fileName) {
+    unsigned int width = liq_image_get_width(image);
+    unsigned int height = liq_image_get_height(image);
+    unsigned char *compressed = NULL;
+    size_t compressed_size = 0;
 
     liq_set_dithering_level(res, 1.0f);
 
-    int buffer_size = width * height;
+    size_t buffer_size = (size_t)width * height;
     unsigned char* buffer = (unsigned char*)malloc(buffer_size);
 
     if (liq_write_remapped_image(res, image, buffer, buffer_size) != LIQ_OK) {
@@ -123,6 +225,9 @@ bool PngQuantOptimizer::optimizeFile(const QString& fileName) {
 
     const liq_palette* pal = liq_get_palette(res);
 
+    LodePNGState state;
+    lodepng_state_init(&state);
+
     state.info_raw.colortype = LCT_PALETTE;
     state.info_raw.bitdepth = 8;
     state.info_png.color.colortype = LCT_PALETTE;
@@ -140,18 +245,14 @@ bool PngQuantOptimizer::optimizeFile(const QString& fileName) {
         lodepng_palette_add(&state.info_raw, pal->entries[i].r, pal->entries[i].g, pal->entries[i].b, pal->entries[i].a);
     }
 
-    lodepng_encode(&compressed, &compressed_size, buffer, width, height, &state);
-    lodepng_save_file(compressed, compressed_size, fileName.toStdString().c_str());
+    unsigned error = lodepng_encode(&compressed, &compressed_size, buffer, width, height, &state);
+    if (!error) {
+        error = lodepng_save_file(compressed, compressed_size, fileName.toStdString().c_str());
+    }
 
     lodepng_state_cleanup(&state);
     free(buffer);
     free(compressed);
 
-    return true;
-}
-
-bool PngQuantOptimizer::setOptions(int optLevel) {
-    _optLevel = optLevel;
-
-    return true;
+    return !error;
 }
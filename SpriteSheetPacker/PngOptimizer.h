@@ -2,6 +2,7 @@
 #define PNGOPTIMIZER_H
 
 #include <QtCore>
+#include <QImage>
 #include "opnglib.h"
 #include "libimagequant.h"
 
@@ -13,6 +14,8 @@ public:
 public:
     virtual bool optimizeFiles(const QStringList&) { return true; }
     virtual bool optimizeFile(const QString&) { return true; }
+    // encodes the image straight to the optimized png file, without an intermediate png
+    virtual bool optimizeImage(const QImage& image, const QString& fileName) { return image.save(fileName, "png"); }
 
     virtual bool setOptions(int) { return true; }
 };
@@ -20,16 +23,25 @@ public:
 class OptiPngOptimizer : public PngOptimizer {
 
 public:
-    OptiPngOptimizer(int optLevel = 0);
+    OptiPngOptimizer(int optLevel = 0, int threads = trialThreads());
     ~OptiPngOptimizer();
 
     bool optimizeFiles(const QStringList& fileNames) override;
     bool optimizeFile(const QString& fileName) override;
+    bool optimizeImage(const QImage& image, const QString& fileName) override;
 
     bool setOptions(int optLevel) override;
+    // compression trials run at once, 0 - one per core, 1 - one after another
+    void setThreads(int threads);
+
+    // user preferences
+    static int trialThreads();
 
 private:
+    static void runTrials(void (*trial)(void*, int), void* trialArg, int count, void* userArg);
+
     int _optLevel;
+    int _threads;
 
     opng_options options;
     opng_optimizer_t* optimizer;
@@ -44,15 +56,18 @@ public:
 
     bool optimizeFiles(const QStringList& fileNames) override;
     bool optimizeFile(const QString& fileName) override;
+    bool optimizeImage(const QImage& source, const QString& fileName) override;
+    // quantizes all the images once, to a single palette
+    bool optimizeImages(const QVector<QImage>& sources, const QStringList& fileNames);
 
     bool setOptions(int optLevel) override;
 
 private:
+    bool writeImage(liq_result* res, liq_image* image, const QString& fileName);
+
     int _optLevel;
 
     liq_attr* attr;
-    liq_image* image;
-    liq_result* res;
 };
 
 #endif // PNGOPTIMIZER_H
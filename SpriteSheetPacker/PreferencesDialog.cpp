@@ -1,5 +1,10 @@
 #include "PreferencesDialog.h"
 #include "ui_PreferencesDialog.h"
+#include "PreprocessCache.h"
+#include "LayoutCache.h"
+#include "SpriteAtlas.h"
+#include "PngOptimizer.h"
+#include "PublishSpriteSheet.h"
 
 PreferencesDialog::PreferencesDialog(QWidget *parent) :
     QDialog(parent),
@@ -11,6 +16,16 @@ PreferencesDialog::PreferencesDialog(QWidget *parent) :
     QSettings settings;
     QString customFormatFolder = settings.value("Preferences/customFormatFolder").toString();
     ui->customFormatFolderEdit->setText(customFormatFolder);
+
+    ui->preprocessCacheCheckBox->setChecked(PreprocessCache::isEnabled());
+    ui->preprocessCachePixelsCheckBox->setChecked(PreprocessCache::storePixels());
+    ui->preprocessCachePixelsCheckBox->setEnabled(PreprocessCache::isEnabled());
+    connect(ui->preprocessCacheCheckBox, &QCheckBox::toggled, ui->preprocessCachePixelsCheckBox, &QCheckBox::setEnabled);
+    ui->layoutCacheCheckBox->setChecked(LayoutCache::isEnabled());
+
+    ui->variantThreadsSpinBox->setValue(SpriteAtlas::variantThreads());
+    ui->pngTrialThreadsSpinBox->setValue(OptiPngOptimizer::trialThreads());
+    ui->cczCompressionLevelSpinBox->setValue(PublishSpriteSheet::cczCompressionLevel());
 }
 
 PreferencesDialog::~PreferencesDialog() {
@@ -33,6 +48,18 @@ void PreferencesDialog::on_toolButton_clicked() {
 void PreferencesDialog::on_buttonBox_accepted() {
     QSettings settings;
     settings.setValue("Preferences/customFormatFolder", ui->customFormatFolderEdit->text());
+    settings.setValue("Preferences/preprocessCache", ui->preprocessCacheCheckBox->isChecked());
+    settings.setValue("Preferences/preprocessCachePixels", ui->preprocessCachePixelsCheckBox->isChecked());
+    settings.setValue("Preferences/layoutCache", ui->layoutCacheCheckBox->isChecked());
+    settings.setValue("Preferences/variantThreads", ui->variantThreadsSpinBox->value());
+    settings.setValue("Preferences/pngTrialThreads", ui->pngTrialThreadsSpinBox->value());
+    settings.setValue("Preferences/cczCompressionLevel", ui->cczCompressionLevelSpinBox->value());
+}
+
+void PreferencesDialog::on_clearCachePushButton_clicked() {
+    if (!PreprocessCache::clear()) {
+        QMessageBox::warning(this, "Clear cache", "Unable to remove:\n" + PreprocessCache::cachePath());
+    }
 }
 
 void PreferencesDialog::on_resetAllPushButton_clicked() {
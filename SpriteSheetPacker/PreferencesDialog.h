@@ -19,6 +19,7 @@ private slots:
     void on_toolButton_clicked();
     void on_buttonBox_accepted();
     void on_resetAllPushButton_clicked();
+    void on_clearCachePushButton_clicked();
     
 private:
     Ui::PreferencesDialog *ui;
@@ -0,0 +1,95 @@
+#include "PreprocessCache.h"
+#include "SpriteAtlas.h"
+
+static const quint32 kCacheMagic = 0x53535043; // SSPC
+static const quint32 kCacheVersion = 4;
+
+QString PreprocessCache::key(const QString& fileName, const Settings& settings) {
+    QFileInfo fi(fileName);
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << kCacheVersion
+           << fi.absoluteFilePath()
+           << settings.scale
+           << settings.trim
+           << settings.heuristicMask
+           << settings.polygonMode
+           << (settings.polygonMode? settings.epsilon : 0.f)
+           << settings.parentScale;
+
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+}
+
+bool PreprocessCache::load(const QString& key, const QString& fileName, PackContent& content) {
+    QFile file(cachePath() + "/" + key);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QFileInfo fi(fileName);
+    QDataStream stream(&file);
+    quint32 magic, version;
+    qint64 size, lastModified;
+    stream >> magic >> version >> size >> lastModified;
+    if ((magic != kCacheMagic) || (version != kCacheVersion)) {
+        return false;
+    }
+    if ((size != fi.size()) || (lastModified != fi.lastModified().toMSecsSinceEpoch())) {
+        return false;
+    }
+
+    return content.load(stream);
+}
+
+bool PreprocessCache::save(const QString& key, const QString& fileName, const PackContent& content, bool storePixels) {
+    static QAtomicInt pruned(0);
+    if (pruned.testAndSetRelaxed(0, 1)) {
+        prune(maxAgeDays);
+    }
+
+    if (!QDir().mkpath(cachePath())) {
+        return false;
+    }
+
+    QSaveFile file(cachePath() + "/" + key);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QFileInfo fi(fileName);
+    QDataStream stream(&file);
+    stream << kCacheMagic << kCacheVersion << fi.size() << fi.lastModified().toMSecsSinceEpoch();
+    content.save(stream, storePixels);
+
+    return file.commit();
+}
+
+QString PreprocessCache::cachePath() {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/preprocess";
+}
+
+bool PreprocessCache::clear() {
+    return QDir(cachePath()).removeRecursively();
+}
+
+void PreprocessCache::prune(int days) {
+    QDateTime oldest = QDateTime::currentDateTime().addDays(-days);
+    QDirIterator entries(cachePath(), QDir::Files | QDir::NoDotAndDotDot);
+    while (entries.hasNext()) {
+        entries.next();
+        if (entries.fileInfo().lastModified() < oldest) {
+            QFile::remove(entries.filePath());
+        }
+    }
+}
+
+bool PreprocessCache::isEnabled() {
+    QSettings settings;
+    return settings.value("Preferences/preprocessCache", true).toBool();
+}
+
+bool PreprocessCache::storePixels() {
+    QSettings settings;
+    return settings.value("Preferences/preprocessCachePixels", false).toBool();
+}
@@ -0,0 +1,40 @@
+#ifndef PREPROCESSCACHE_H
+#define PREPROCESSCACHE_H
+
+#include <QtCore>
+
+class PackContent;
+
+// On-disk cache of preprocessed sprites (trim rect, hash, polygons, triangles and optionally the scaled pixels).
+// Entries live under the user cache dir and are keyed by the source path and by every setting that changes the
+// preprocessing result. The size and mtime of the source are stored in the entry, so an edited source misses the cache
+// and its new entry replaces the old one. Entries older than maxAgeDays are removed on the first save of a run.
+class PreprocessCache
+{
+public:
+    struct Settings {
+        float scale;
+        int   trim;
+        bool  heuristicMask;
+        bool  polygonMode;
+        float epsilon;
+        float parentScale;
+    };
+
+    static QString key(const QString& fileName, const Settings& settings);
+
+    static bool load(const QString& key, const QString& fileName, PackContent& content);
+    static bool save(const QString& key, const QString& fileName, const PackContent& content, bool storePixels);
+
+    static QString cachePath();
+    static bool clear();
+    static void prune(int days);
+
+    static const int maxAgeDays = 30;
+
+    // user preferences
+    static bool isEnabled();
+    static bool storePixels();
+};
+
+#endif // PREPROCESSCACHE_H
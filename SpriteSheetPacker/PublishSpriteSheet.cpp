@@ -6,6 +6,7 @@
 #include "PngOptimizer.h"
 #include "PVRTexture.h"
 #include "PVRTextureUtilities.h"
+#include "zlib.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 unsigned int checksumPvr(const unsigned int *data, unsigned int len) {
@@ -21,43 +22,57 @@ unsigned int checksumPvr(const unsigned int *data, unsigned int len) {
     return cs;
 }
 
-void encodePvr(unsigned int *data, unsigned int len, unsigned int keys[4]) {
-    unsigned int encryptionKey[1024];
-    memset(encryptionKey, 0, sizeof(encryptionKey));
+// the long key is built once per key and reused by every texture
+QVector<unsigned int> encryptionKeyPvr(const unsigned int keys[4]) {
+    static QMutex mutex;
+    static QHash<QByteArray, QVector<unsigned int>> encryptionKeys;
 
-    bool s_bEncryptionKeyIsValid = false;
+    QByteArray id((const char*)keys, 4 * sizeof(unsigned int));
+    QMutexLocker locker(&mutex);
+    auto it = encryptionKeys.find(id);
+    if (it != encryptionKeys.end()) {
+        return it.value();
+    }
 
     const int enclen = 1024;
-    const int securelen = 512;
-    const int distance = 64;
+    QVector<unsigned int> longKey(enclen, 0);
+    unsigned int* encryptionKey = longKey.data();
 
     // create long key
-    if(!s_bEncryptionKeyIsValid) {
-        unsigned int y, p, e;
-        unsigned int rounds = 6;
-        unsigned int sum = 0;
-        unsigned int z = encryptionKey[enclen-1];
+    unsigned int y, p, e;
+    unsigned int rounds = 6;
+    unsigned int sum = 0;
+    unsigned int z = encryptionKey[enclen-1];
 
-        do {
+    do {
 #define DELTA 0x9e3779b9
 #define MX (((z>>5^y<<2) + (y>>3^z<<4)) ^ ((sum^y) + (keys[(p&3)^e] ^ z)))
 
-            sum += DELTA;
-            e = (sum >> 2) & 3;
+        sum += DELTA;
+        e = (sum >> 2) & 3;
 
-            for (p = 0; p < enclen - 1; p++)
-            {
-                y = encryptionKey[p + 1];
-                z = encryptionKey[p] += MX;
-            }
+        for (p = 0; p < enclen - 1; p++)
+        {
+            y = encryptionKey[p + 1];
+            z = encryptionKey[p] += MX;
+        }
 
-            y = encryptionKey[0];
-            z = encryptionKey[enclen - 1] += MX;
+        y = encryptionKey[0];
+        z = encryptionKey[enclen - 1] += MX;
 
-        } while (--rounds);
+    } while (--rounds);
 
-        s_bEncryptionKeyIsValid = true;
-    }
+    encryptionKeys.insert(id, longKey);
+    return longKey;
+}
+
+void encodePvr(unsigned int *data, unsigned int len, unsigned int keys[4]) {
+    const QVector<unsigned int> longKey = encryptionKeyPvr(keys);
+    const unsigned int* encryptionKey = longKey.constData();
+
+    const int enclen = 1024;
+    const int securelen = 512;
+    const int distance = 64;
 
     int b = 0;
     unsigned int i = 0;
@@ -84,6 +99,106 @@ void encodePvr(unsigned int *data, unsigned int len, unsigned int keys[4]) {
 
 using namespace pvrtexture;
 
+struct CCZHeader {
+    unsigned char   sig[4];             /** Signature. Should be 'CCZ!' 4 bytes. */
+    unsigned short  compression_type;   /** Should be 0. */
+    unsigned short  version;            /** Should be 2 (although version type==1 is also supported). */
+    unsigned int    reserved;           /** Reserved for users. */
+    unsigned int    len;                /** Size of the uncompressed file. */
+};
+
+// the .pvr file (header, meta data, texture data) is deflated straight behind the ccz header
+bool savePvrCcz(const CPVRTexture& texture, const QString& fileName, int level, const QString& encryptionKey) {
+    PVRTextureHeaderV3 pvrHeader = texture.getFileHeader();
+    pvrHeader.u32MetaDataSize = texture.getMetaDataSize();
+
+    QByteArray metaData;
+    metaData.reserve(pvrHeader.u32MetaDataSize);
+    const MetaDataMap* metaDataMap = texture.getMetaDataMap();
+    for (uint32 i = 0; metaDataMap && (i < metaDataMap->GetSize()); ++i) {
+        const CPVRTMap<uint32, MetaDataBlock>* blocks = metaDataMap->GetDataAtIndex(i);
+        for (uint32 j = 0; j < blocks->GetSize(); ++j) {
+            const MetaDataBlock* block = blocks->GetDataAtIndex(j);
+            metaData.append((const char*)&block->DevFOURCC, sizeof(block->DevFOURCC));
+            metaData.append((const char*)&block->u32Key, sizeof(block->u32Key));
+            metaData.append((const char*)&block->u32DataSize, sizeof(block->u32DataSize));
+            metaData.append((const char*)block->Data, block->u32DataSize);
+        }
+    }
+
+    const QPair<const Bytef*, uLong> parts[] = {
+        qMakePair((const Bytef*)&pvrHeader, (uLong)PVRTEX3_HEADERSIZE),
+        qMakePair((const Bytef*)metaData.constData(), (uLong)metaData.size()),
+        qMakePair((const Bytef*)texture.getDataPtr(), (uLong)texture.getDataSize())
+    };
+    uLong uncompressedLen = 0;
+    for (const auto& part: parts) {
+        uncompressedLen += part.second;
+    }
+
+    if ((level < Z_DEFAULT_COMPRESSION) || (level > Z_BEST_COMPRESSION)) {
+        return false;
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit(&stream, level) != Z_OK) {
+        return false;
+    }
+
+    QByteArray compressedData(sizeof(CCZHeader) + deflateBound(&stream, uncompressedLen), Qt::Uninitialized);
+    stream.next_out = (Bytef*)compressedData.data() + sizeof(CCZHeader);
+    stream.avail_out = compressedData.size() - sizeof(CCZHeader);
+
+    int result = Z_OK;
+    for (const auto& part: parts) {
+        stream.next_in = (Bytef*)part.first;
+        stream.avail_in = part.second;
+        bool last = (&part == &parts[2]);
+        result = deflate(&stream, last? Z_FINISH : Z_NO_FLUSH);
+        if (result == Z_STREAM_ERROR) break;
+    }
+    compressedData.resize(sizeof(CCZHeader) + stream.total_out);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        return false;
+    }
+
+    CCZHeader* cczHeader = (CCZHeader*)compressedData.data();
+    cczHeader->sig[0] = 'C';
+    cczHeader->sig[1] = 'C';
+    cczHeader->sig[2] = 'Z';
+    cczHeader->sig[3] = encryptionKey.isEmpty()? '!':'p';
+    cczHeader->compression_type = qToBigEndian<unsigned short>(0);
+    cczHeader->version = qToBigEndian<unsigned short>(0);
+    cczHeader->reserved = qToBigEndian<unsigned int>(0);
+    cczHeader->len = qToBigEndian<unsigned int>(uncompressedLen);
+
+    // encrypt
+    if (!encryptionKey.isEmpty()) {
+        QString key = encryptionKey;
+        uint32_t keys[4];
+        keys[0] = key.left(8).toUInt(nullptr, 16); key.remove(0, 8);
+        keys[1] = key.left(8).toUInt(nullptr, 16); key.remove(0, 8);
+        keys[2] = key.left(8).toUInt(nullptr, 16); key.remove(0, 8);
+        keys[3] = key.left(8).toUInt(nullptr, 16); key.remove(0, 8);
+
+        unsigned int* ints = (unsigned int*)(compressedData.data()+12);
+        unsigned int enclen = (compressedData.length()-12)/4;
+
+        cczHeader->reserved = qToBigEndian<unsigned int>(checksumPvr(ints, enclen));
+
+        encodePvr(ints, enclen, keys);
+    }
+
+    // write compressed data
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    return file.write(compressedData) == compressedData.size();
+}
+
 QMap<QString, QString> PublishSpriteSheet::_formats;
 
 QString imagePrefix(ImageFormat imageFormat) {
@@ -151,29 +266,51 @@ PublishSpriteSheet::PublishSpriteSheet() {
     _imageFormat = kPNG;
     _pixelFormat = kARGB8888;
     _premultiplied = true;
+    _pngQuality.trialThreads = OptiPngOptimizer::trialThreads();
+    _pngQuality.sharedPalette = false;
     _webpQuality = 80;
     _jpgQuality = 80;
+    _cczCompressionLevel = cczCompressionLevel();
+    _optimizeProgress.count = 0;
 
     _trimSpriteNames = true;
     _prependSmartFolderName = true;
 }
 
+PublishSpriteSheet::~PublishSpriteSheet() {
+    // the jobs use the publisher till the end
+    _optimizePool.waitForDone();
+}
+
+int PublishSpriteSheet::cczCompressionLevel() {
+    QSettings settings;
+    return qBound(Z_DEFAULT_COMPRESSION, settings.value("Preferences/cczCompressionLevel", Z_DEFAULT_COMPRESSION).toInt(), Z_BEST_COMPRESSION);
+}
+
 void PublishSpriteSheet::addSpriteSheet(const SpriteAtlas &atlas, const QString &fileName) {
     _spriteAtlases.append(atlas);
     _fileNames.append(fileName);
 }
 
 bool PublishSpriteSheet::publish(const QString& format, bool errorMessage) {
+    _optimizeProgress.count = 0;
 
     if (_spriteAtlases.size() != _fileNames.size()) {
         return false;
     }
 
-    QStringList outputFilePaths;
+    bool optimizeImage = (_imageFormat == kPNG) && (_pngQuality.optMode != "None");
+    bool sharedPalette = _pngQuality.sharedPalette && (_pngQuality.optMode == "Lossy");
+    QVector<PngBatch> optimizeBatches;
     for (int i = 0; i < _spriteAtlases.size(); i++) {
         const SpriteAtlas& atlas = _spriteAtlases.at(i);
         const QString& filePath = _fileNames.at(i);
 
+        // the pages of a shared palette are optimized together, other pages one by one
+        if (sharedPalette && atlas.outputData().size()) {
+            optimizeBatches.push_back(PngBatch());
+        }
+
         for (int n=0; n<atlas.outputData().size(); ++n) {
             const auto& outputData = atlas.outputData().at(n);
 
@@ -186,9 +323,6 @@ bool PublishSpriteSheet::publish(const QString& format, bool errorMessage) {
                 outputFilePath = outputFilePath + "_" + QString::number(n);
             }
 
-            // save this name for optimize png
-            outputFilePaths.push_back(outputFilePath);
-
             // generate the data file and the image
             if (!format.isEmpty() && !generateDataFile(outputFilePath, format, outputData._spriteFrames, outputData._atlasImage, errorMessage)) {
                 return false;
@@ -199,7 +333,13 @@ bool PublishSpriteSheet::publish(const QString& format, bool errorMessage) {
             qDebug() << "Save image:" << fileName;
             if ((_imageFormat == kPNG) || (_imageFormat == kWEBP) || (_imageFormat == kJPG) || (_imageFormat == kJPG_PNG)) {
                 QImage image = convertImage(outputData._atlasImage, _pixelFormat, _premultiplied);
-                if (_imageFormat == kPNG) {
+                if (optimizeImage) {
+                    // the optimizer encodes the final png itself
+                    if (!sharedPalette) {
+                        optimizeBatches.push_back(PngBatch());
+                    }
+                    optimizeBatches.back().push_back(qMakePair(outputFilePath, image));
+                } else if (_imageFormat == kPNG) {
                     QImageWriter writer(outputFilePath + imagePrefix(kPNG), "png");
                     writer.setOptimizedWrite(true);
                     writer.setCompression(100);
@@ -250,63 +390,12 @@ bool PublishSpriteSheet::publish(const QString& format, bool errorMessage) {
                 qDebug() << "Transcode complete.";
                 // save the file
                 if (_imageFormat == kPVR_CCZ) {
-                    QString tempFileName = outputFilePath + "_temp.pvr";
-                    pvrTexture.saveFile(tempFileName.toStdString().c_str());
-
-                    // read and compress
-                    QFile file(tempFileName);
-                    file.open(QIODevice::ReadOnly);
-                    unsigned int uncompressedLen = file.size();
-                    QByteArray compressedData = qCompress(file.readAll());
-                    file.close();
-                    QFile::remove(tempFileName);
-
-                    //  Strip the first six bytes (a 4-byte length put on by qCompress)
-                    compressedData.remove(0, 4);
-
-                    struct CCZHeader {
-                        unsigned char   sig[4];             /** Signature. Should be 'CCZ!' 4 bytes. */
-                        unsigned short  compression_type;   /** Should be 0. */
-                        unsigned short  version;            /** Should be 2 (although version type==1 is also supported). */
-                        unsigned int    reserved;           /** Reserved for users. */
-                        unsigned int    len;                /** Size of the uncompressed file. */
-                    };
-
-                    CCZHeader cczHeader;
-                    cczHeader.sig[0] = 'C';
-                    cczHeader.sig[1] = 'C';
-                    cczHeader.sig[2] = 'Z';
-                    cczHeader.sig[3] = _encryptionKey.isEmpty()? '!':'p';
-                    cczHeader.compression_type = qToBigEndian<unsigned short>(0);
-                    cczHeader.version = qToBigEndian<unsigned short>(0);
-                    cczHeader.reserved = qToBigEndian<unsigned int>(0);
-                    cczHeader.len = qToBigEndian<unsigned int>(uncompressedLen);
-
-                    compressedData.insert(0, QByteArray((const char *)&cczHeader, sizeof(CCZHeader)));
-
-                    // encrypt
-                    if (!_encryptionKey.isEmpty()) {
-                        QString key = _encryptionKey;
-                        uint32_t keys[4];
-                        keys[0] = key.left(8).toUInt(nullptr, 16); key.remove(0, 8);
-                        keys[1] = key.left(8).toUInt(nullptr, 16); key.remove(0, 8);
-                        keys[2] = key.left(8).toUInt(nullptr, 16); key.remove(0, 8);
-                        keys[3] = key.left(8).toUInt(nullptr, 16); key.remove(0, 8);
-
-                        unsigned int* ints = (unsigned int*)(compressedData.data()+12);
-                        unsigned int enclen = (compressedData.length()-12)/4;
-
-                        CCZHeader* header = (CCZHeader*)compressedData.data();
-                        header->reserved = qToBigEndian<unsigned int>(checksumPvr(ints, enclen));
-
-                        encodePvr(ints, enclen, keys);
+                    if (!savePvrCcz(pvrTexture, fileName, _cczCompressionLevel, _encryptionKey)) {
+                        QString errorString = QString("Unable to write [%1]").arg(fileName);
+                        qDebug() << errorString;
+                        if (errorMessage) QMessageBox::critical(NULL, "Export image error", errorString);
+                        return false;
                     }
-
-                    // write compressed data
-                    file.setFileName(fileName);
-                    file.open(QIODevice::WriteOnly);
-                    file.write(compressedData);
-                    file.close();
                 } else {
                     pvrTexture.saveFile(fileName.toStdString().c_str());
                 }
@@ -315,10 +404,10 @@ bool PublishSpriteSheet::publish(const QString& format, bool errorMessage) {
         }
     }
 
-    if ((_imageFormat == kPNG) && (_pngQuality.optMode != "None")) {
+    if (optimizeImage) {
         qDebug() << "Begin optimize image...";
         // we use values 1-7 so that it is more user friendly, because 0 also means optimization.
-        optimizePNGInThread(outputFilePaths, _pngQuality.optMode, _pngQuality.optLevel - 1);
+        optimizePNGInThread(optimizeBatches, _pngQuality.optMode, _pngQuality.optLevel - 1, sharedPalette);
     }
 
     _spriteAtlases.clear();
@@ -444,34 +533,105 @@ bool PublishSpriteSheet::generateDataFile(const QString& filePath, const QString
     return true;
 }
 
-bool PublishSpriteSheet::optimizePNG(const QString& fileName, const QString& optMode, int optLevel) {
-    bool result = false;
+bool PublishSpriteSheet::optimizePNG(const PngBatch& batch, const QString& optMode, int optLevel, int trialThreads, bool sharedPalette) {
+    QElapsedTimer timer;
+    timer.start();
 
-    if (optMode == "Lossless") {
-        OptiPngOptimizer optimizer(optLevel);
+    QVector<QImage> images;
+    QStringList pngFileNames;
+    for (const auto& image : batch) {
+        images.push_back(image.second);
+        pngFileNames.push_back(image.first + ".png");
+    }
 
-        _mutex.lock();
-        result = optimizer.optimizeFile(fileName + ".png");
-        _mutex.unlock();
-    } else if (optMode == "Lossy") {
-        PngQuantOptimizer optimizer(optLevel);
+    bool result = true;
+    auto optimized = [&](int i, bool optimizedImage, qint64 elapsed) {
+        const QString& pngFileName = pngFileNames[i];
+        if (!optimizedImage) {
+            qDebug() << "Optimize failed, save not optimized:" << pngFileName;
+            QImageWriter writer(pngFileName, "png");
+            writer.setOptimizedWrite(true);
+            writer.setCompression(100);
+            writer.setQuality(0);
+            writer.write(images[i]);
+            result = false;
+        }
+
+        qint64 rawSize = (qint64)images[i].width() * images[i].height() * 4;
+        qint64 fileSize = QFileInfo(pngFileName).size();
+        qDebug() << "Optimized" << pngFileName << rawSize << "->" << fileSize << "bytes in" << elapsed << "ms";
 
         _mutex.lock();
-        result = optimizer.optimizeFile(fileName + ".png");
+        int completed = ++_optimizeProgress.completed;
+        int count = _optimizeProgress.count;
+        _optimizeProgress.rawSize += rawSize;
+        _optimizeProgress.fileSize += fileSize;
+        qint64 totalRawSize = _optimizeProgress.rawSize;
+        qint64 totalFileSize = _optimizeProgress.fileSize;
+        qint64 totalElapsed = _optimizeProgress.timer.elapsed();
         _mutex.unlock();
+
+        emit onOptimizedPNG(pngFileName, rawSize, fileSize, elapsed, completed, count);
+        if (completed == count) {
+            qDebug() << "Optimize complete:" << totalRawSize << "->" << totalFileSize << "bytes in" << totalElapsed << "ms";
+            emit onCompletedOptimizePNG(totalRawSize, totalFileSize, totalElapsed);
+        }
+    };
+
+    if (optMode == "Lossy") {
+        // one attr per pool thread, reused by every page the thread optimizes
+        static thread_local PngQuantOptimizer optimizer;
+        optimizer.setOptions(optLevel);
+        if (sharedPalette && (batch.size() > 1)) {
+            bool shared = optimizer.optimizeImages(images, pngFileNames);
+            // the pages of a shared palette share its time
+            qint64 elapsed = timer.elapsed() / batch.size();
+            for (int i = 0; i < batch.size(); ++i) {
+                optimized(i, shared, elapsed);
+            }
+        } else {
+            for (int i = 0; i < batch.size(); ++i) {
+                timer.restart();
+                bool optimizedImage = optimizer.optimizeImage(images[i], pngFileNames[i]);
+                optimized(i, optimizedImage, timer.elapsed());
+            }
+        }
+    } else if (optMode == "Lossless") {
+        OptiPngOptimizer optimizer(optLevel, trialThreads);
+        for (int i = 0; i < batch.size(); ++i) {
+            timer.restart();
+            bool optimizedImage = optimizer.optimizeImage(images[i], pngFileNames[i]);
+            optimized(i, optimizedImage, timer.elapsed());
+        }
+    } else {
+        for (int i = 0; i < batch.size(); ++i) {
+            optimized(i, false, 0);
+        }
     }
 
     return result;
 }
 
-void PublishSpriteSheet::optimizePNGInThread(QStringList fileNames, const QString& optMode, int optLevel) {
-    QObject::connect(&_watcher, SIGNAL(finished()), this, SIGNAL(onCompletedOptimizePNG()));
+void PublishSpriteSheet::optimizePNGInThread(const QVector<PngBatch>& batches, const QString& optMode, int optLevel, bool sharedPalette) {
+    _optimizeProgress.count = 0;
+    for (const PngBatch& batch : batches) {
+        _optimizeProgress.count += batch.size();
+    }
+    _optimizeProgress.completed = 0;
+    _optimizeProgress.rawSize = 0;
+    _optimizeProgress.fileSize = 0;
+    _optimizeProgress.timer.start();
+    if (!_optimizeProgress.count) {
+        return;
+    }
 
-    QFuture<bool> resultFuture;
+    // jobs in parallel up to the core budget, the cores left over run the compression trials of every file
+    int budget = QThread::idealThreadCount();
+    int jobsAtOnce = qBound(1, batches.size(), budget);
+    int trialThreads = _pngQuality.trialThreads? _pngQuality.trialThreads : qMax(1, budget / jobsAtOnce);
+    _optimizePool.setMaxThreadCount(jobsAtOnce);
 
-    for (const QString& fileName : fileNames) {
-        resultFuture = QtConcurrent::run(this, &PublishSpriteSheet::optimizePNG, fileName, optMode, optLevel);
+    for (const PngBatch& batch : batches) {
+        QtConcurrent::run(&_optimizePool, this, &PublishSpriteSheet::optimizePNG, batch, optMode, optLevel, trialThreads, sharedPalette);
     }
-
-    _watcher.setFuture(resultFuture);
 }
@@ -25,34 +25,59 @@ class PublishSpriteSheet: public QObject {
 
 public:
     PublishSpriteSheet();
+    ~PublishSpriteSheet();
 
     void addSpriteSheet(const SpriteAtlas& atlas, const QString& fileName);
     void setImageFormat(ImageFormat imageFormat) { _imageFormat = imageFormat; }
     void setPixelFormat(PixelFormat pixelFormat) { _pixelFormat = pixelFormat; }
     void setPremultiplied(bool premultiplied) { _premultiplied = premultiplied; }
     void setPngQuality(const QString& optMode, int optLevel) { _pngQuality.optMode = optMode; _pngQuality.optLevel = optLevel; }
+    // compression trials of the lossless optimization run at once, 0 - one per core
+    void setPngTrialThreads(int threads) { _pngQuality.trialThreads = threads; }
+    // lossy optimization quantizes the pages of every atlas to one palette
+    void setPngSharedPalette(bool shared) { _pngQuality.sharedPalette = shared; }
     void setWebpQuality(int quality) { _webpQuality = quality; }
     void setJpgQuality(int quality) { _jpgQuality = quality; }
     void setTrimSpriteNames(bool trimSpriteNames) { _trimSpriteNames = trimSpriteNames; }
     void setPrependSmartFolderName(bool prependSmartFolderName) { _prependSmartFolderName = prependSmartFolderName; }
     void setEncryptionKey(const QString& key) { _encryptionKey = key; }
+    // zlib level of pvr.ccz, -1 - zlib default
+    void setCczCompressionLevel(int level) { _cczCompressionLevel = qBound(-1, level, 9); }
 
     bool publish(const QString& format, bool errorMessage = true);
+    // files queued for png optimization by the last publish, onCompletedOptimizePNG comes only if there are any
+    int optimizePNGCount() const { return _optimizeProgress.count; }
+    // blocks until every png optimization job of the last publish is finished
+    void waitForOptimizePNG() { _optimizePool.waitForDone(); }
 
     static void addFormat(const QString& format, const QString& scriptFileName) { _formats[format] = scriptFileName; }
     static QMap<QString, QString>& formats() { return _formats; }
+    static int cczCompressionLevel();
 
 signals:
-    void onCompletedOptimizePNG();
+    // emitted from the optimization threads: every optimized file, then once all the files are done
+    // sizes are the pixel data encoded and the png files written, times in milliseconds
+    void onOptimizedPNG(const QString& fileName, qint64 rawSize, qint64 fileSize, qint64 elapsed, int completed, int count);
+    void onCompletedOptimizePNG(qint64 rawSize, qint64 fileSize, qint64 elapsed);
 
 protected:
     bool generateDataFile(const QString& filePath, const QString& format, const QMap<QString, SpriteFrameInfo>& spriteFrames, const QImage& atlasImage, bool errorMessage = true);
-    bool optimizePNG(const QString& fileName, const QString& optMode, int optLevel);
-    void optimizePNGInThread(QStringList fileNames, const QString& optMode, int optLevel);
+    // file names without the extension and the images, optimized by one job: a page, or all the pages of a shared palette
+    typedef QVector<QPair<QString, QImage>> PngBatch;
+
+    bool optimizePNG(const PngBatch& batch, const QString& optMode, int optLevel, int trialThreads, bool sharedPalette);
+    void optimizePNGInThread(const QVector<PngBatch>& batches, const QString& optMode, int optLevel, bool sharedPalette);
 
 protected:
-    QFutureWatcher<bool> _watcher;
+    QThreadPool _optimizePool;
     QMutex _mutex;
+    struct {
+        int     count;
+        int     completed;
+        qint64  rawSize;
+        qint64  fileSize;
+        QElapsedTimer timer;
+    } _optimizeProgress;
 
     QList<SpriteAtlas> _spriteAtlases;
     QStringList _fileNames;
@@ -64,6 +89,8 @@ protected:
     struct {
         QString optMode;
         int     optLevel;
+        int     trialThreads;
+        bool    sharedPalette;
     } _pngQuality;
 
     int         _webpQuality;
@@ -73,6 +100,7 @@ protected:
     bool        _prependSmartFolderName;
 
     QString     _encryptionKey;
+    int         _cczCompressionLevel;
 
     static QMap<QString, QString> _formats;
 };
@@ -0,0 +1,131 @@
+#include "SourceImageStore.h"
+
+#include <cmath>
+#include <algorithm>
+
+SourceImageStore::SourceImageStore(int consumers, bool pyramid)
+    : _consumers(qMax(consumers, 1))
+    , _pyramid(pyramid)
+    , _listed(false)
+{
+
+}
+
+QList< QPair<QString, QString> > SourceImageStore::fileList(const QStringList& sourceList) {
+    QMutexLocker locker(&_mutex);
+    if (!_listed || (_listedSources != sourceList)) {
+        _listedSources = sourceList;
+        _listedFiles = listFiles(sourceList);
+        _listed = true;
+    }
+    return _listedFiles;
+}
+
+void SourceImageStore::addScale(float scale) {
+    QMutexLocker locker(&_mutex);
+    if (!_scales.contains(scale)) {
+        _scales.append(scale);
+        std::sort(_scales.begin(), _scales.end());
+    }
+}
+
+float SourceImageStore::parentScale(float scale) const {
+    if (!_pyramid || (scale >= 1)) {
+        return 1;
+    }
+    // the scales don't change once the build runs
+    auto bigger = std::upper_bound(_scales.begin(), _scales.end(), scale);
+    return ((bigger != _scales.end()) && (*bigger < 1))? *bigger : 1;
+}
+
+QImage SourceImageStore::image(const QString& fileName, float scale) {
+    QSharedPointer<Entry> source = entry(fileName);
+
+    QMutexLocker locker(&source->mutex);
+    if (!source->decoded) {
+        source->original = QImage(fileName);
+        source->decoded = true;
+    }
+    if (source->original.isNull() || (scale == 1)) {
+        return source->original;
+    }
+
+    if (!_pyramid) {
+        QImage original = source->original;
+        locker.unlock();
+        return scaled(original, scale);
+    }
+
+    return level(*source, scale);
+}
+
+QImage SourceImageStore::level(Entry& source, float scale) {
+    if (scale == 1) {
+        return source.original;
+    }
+    auto it = source.levels.constFind(scale);
+    if (it != source.levels.constEnd()) {
+        return it.value();
+    }
+
+    // scale down from the parent level (built first if needed), the size is always taken from the original
+    // so every level has the same size as when it is scaled from the original directly
+    QImage from = level(source, parentScale(scale));
+    QSize size = source.original.size().scaled(ceil(source.original.width() * scale), ceil(source.original.height() * scale), Qt::KeepAspectRatio);
+    QImage image = from.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    source.levels.insert(scale, image);
+    return image;
+}
+
+void SourceImageStore::release(const QString& fileName) {
+    QMutexLocker locker(&_mutex);
+    auto it = _entries.find(fileName);
+    if (it == _entries.end()) {
+        // nothing decoded yet (e.g. the consumer got the sprite from the preprocess cache), the release still counts
+        it = _entries.insert(fileName, QSharedPointer<Entry>(new Entry()));
+    }
+    if (++it.value()->released >= _consumers) {
+        _entries.erase(it);
+    }
+}
+
+QSharedPointer<SourceImageStore::Entry> SourceImageStore::entry(const QString& fileName) {
+    QMutexLocker locker(&_mutex);
+    QSharedPointer<Entry>& source = _entries[fileName];
+    if (!source) {
+        source.reset(new Entry());
+    }
+    return source;
+}
+
+QList< QPair<QString, QString> > SourceImageStore::listFiles(const QStringList& sourceList) {
+    QStringList nameFilter;
+    nameFilter << "*.png" << "*.jpg" << "*.jpeg" << "*.gif" << "*.bmp";
+
+    QList< QPair<QString, QString> > fileList;
+    for(auto pathName: sourceList) {
+        QFileInfo fi(pathName);
+
+        if (fi.isDir()) {
+            QDir dir(fi.path());
+            QDirIterator fileNames(pathName, nameFilter, QDir::Files | QDir::NoSymLinks | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+            while(fileNames.hasNext()){
+                fileNames.next();
+                fileList.push_back(qMakePair(fileNames.filePath(), dir.relativeFilePath(fileNames.filePath())));
+            }
+        } else {
+            fileList.push_back(qMakePair(pathName, fi.fileName()));
+        }
+    }
+    return fileList;
+}
+
+QImage SourceImageStore::scaled(const QImage& image, float scale) {
+    if (image.isNull() || (scale == 1)) return image;
+    return image.scaled(ceil(image.width() * scale), ceil(image.height() * scale), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
+
+bool SourceImageStore::usePyramid() {
+    QSettings settings;
+    return settings.value("Preferences/scalePyramid", false).toBool();
+}
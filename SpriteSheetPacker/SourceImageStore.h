@@ -0,0 +1,62 @@
+#ifndef SOURCEIMAGESTORE_H
+#define SOURCEIMAGESTORE_H
+
+#include <QtCore>
+#include <QImage>
+
+// Decoded source images shared by the scaling variants of one build.
+// Every file is decoded once and each variant gets its own scaled copy. With the pyramid enabled the scaled copies are
+// kept too and a smaller variant is scaled down from the next bigger variant scale instead of the original. The scales
+// are registered before the build starts, so a level is always scaled from the same parent whichever variant asks first.
+// Each of the consumers (one per variant) releases a file after it is done with it; the decoded data is dropped
+// after the last release, so the store does not keep the whole source set alive for the build.
+class SourceImageStore
+{
+public:
+    explicit SourceImageStore(int consumers = 1, bool pyramid = usePyramid());
+
+    // source files (path, sprite name) of the source list, enumerated once for all consumers
+    QList< QPair<QString, QString> > fileList(const QStringList& sourceList);
+
+    bool pyramid() const { return _pyramid; }
+    // the number of consumers actually queued, set before the first image is requested
+    void setConsumers(int consumers) { _consumers = qMax(consumers, 1); }
+    // scale of a variant, all of them must be added before the first image is requested
+    void addScale(float scale);
+    // scale the image of the given scale is scaled from, 1 - the original
+    float parentScale(float scale) const;
+
+    QImage image(const QString& fileName, float scale);
+    void release(const QString& fileName);
+
+    static QList< QPair<QString, QString> > listFiles(const QStringList& sourceList);
+    static QImage scaled(const QImage& image, float scale);
+
+    // user preferences
+    static bool usePyramid();
+
+private:
+    struct Entry {
+        Entry(): decoded(false), released(0) {}
+
+        QMutex mutex;
+        bool decoded;
+        QImage original;
+        QMap<float, QImage> levels;
+        int released;
+    };
+    QSharedPointer<Entry> entry(const QString& fileName);
+    QImage level(Entry& source, float scale);
+
+    int _consumers;
+    bool _pyramid;
+
+    QMutex _mutex;
+    QList<float> _scales;
+    QHash<QString, QSharedPointer<Entry> > _entries;
+    QStringList _listedSources;
+    QList< QPair<QString, QString> > _listedFiles;
+    bool _listed;
+};
+
+#endif // SOURCEIMAGESTORE_H
@@ -1,10 +1,16 @@
 #include "SpriteAtlas.h"
 
 #include <functional>
+#include <QtConcurrent>
 #include "binpack2d.hpp"
+#include "rectpack2d.h"
 #include "polypack2d.h"
 #include "ImageRotate.h"
+#include "ImageTrim.h"
 #include "PolygonImage.h"
+#include "PreprocessCache.h"
+#include "SourceImageStore.h"
+#include "LayoutCache.h"
 
 int pow2(int len) {
     int order = 1;
@@ -18,47 +24,82 @@ int pow2(int len) {
 PackContent::PackContent() {
     // only for QVector
     qDebug() << "PackContent::PackContent()";
+    _cropped = false;
+    _hash = 0;
 }
 PackContent::PackContent(const QString& name, const QImage& image) {
     _name = name;
     _image = image;
+    _size = image.size();
     _rect = QRect(0, 0, _image.width(), _image.height());
+    _cropped = false;
+    _hash = 0;
 }
 
-bool PackContent::isIdentical(const PackContent& other) {
+bool PackContent::isIdentical(const PackContent& other) const {
     if (_rect != other._rect) return false;
 
-    for (int x = _rect.left(); x < _rect.right(); ++x) {
-        for (int y = _rect.top(); y < _rect.bottom(); ++y) {
-            if (_image.pixel(x, y) != other._image.pixel(x, y)) return false;
+    // the compared region starts at the image origin when the image is cropped
+    QPoint origin = _cropped? QPoint(0, 0) : _rect.topLeft();
+    QPoint otherOrigin = other._cropped? QPoint(0, 0) : _rect.topLeft();
+    if ((_image.format() == other._image.format()) && (_image.depth() == 32)) {
+        size_t lineSize = (_rect.right() - _rect.left()) * sizeof(QRgb);
+        for (int y = 0; y < _rect.height() - 1; ++y) {
+            const uchar* line = _image.constScanLine(origin.y() + y) + origin.x() * sizeof(QRgb);
+            const uchar* otherLine = other._image.constScanLine(otherOrigin.y() + y) + otherOrigin.x() * sizeof(QRgb);
+            if (memcmp(line, otherLine, lineSize) != 0) return false;
+        }
+        return true;
+    }
+
+    for (int x = 0; x < _rect.width() - 1; ++x) {
+        for (int y = 0; y < _rect.height() - 1; ++y) {
+            if (_image.pixel(origin.x() + x, origin.y() + y) != other._image.pixel(otherOrigin.x() + x, otherOrigin.y() + y)) return false;
         }
     }
 
     return true;
 }
 
-void PackContent::trim(int alpha) {
-    int l = _image.width();
-    int t = _image.height();
-    int r = 0;
-    int b = 0;
-    for (int y=0; y<_image.height(); y++) {
-        bool rowFilled = false;
-        for (int x=0; x<_image.width(); x++) {
-            int a = qAlpha(_image.pixel(x, y));
-            if (a >= alpha) {
-                rowFilled = true;
-                r = qMax(r, x);
-                if (l > x) {
-                    l = x;
-                }
+static inline quint64 hashMix(quint64 h, quint64 value) {
+    h ^= value * 0x9e3779b97f4a7c15ULL;
+    h = (h << 31) | (h >> 33);
+    return h * 0xc2b2ae3d27d4eb4fULL;
+}
+
+void PackContent::updateHash() {
+    // hash the same region that isIdentical compares, so identical contents always share a hash
+    quint64 h = hashMix(hashMix(0, _rect.left() | ((quint64)_rect.top() << 32)), _rect.width() | ((quint64)_rect.height() << 32));
+    QPoint origin = _cropped? QPoint(0, 0) : _rect.topLeft();
+    if (_image.depth() == 32) {
+        int lineSize = (_rect.right() - _rect.left()) * sizeof(QRgb);
+        for (int y = 0; y < _rect.height() - 1; ++y) {
+            const uchar* line = _image.constScanLine(origin.y() + y) + origin.x() * sizeof(QRgb);
+            int i = 0;
+            for (; i + 8 <= lineSize; i += 8) {
+                quint64 value;
+                memcpy(&value, line + i, 8);
+                h = hashMix(h, value);
+            }
+            if (i < lineSize) {
+                quint32 value;
+                memcpy(&value, line + i, 4);
+                h = hashMix(h, value);
             }
         }
-        if (rowFilled) {
-            t = qMin(t, y);
-            b = y;
+    } else {
+        for (int y = origin.y(); y < origin.y() + _rect.height() - 1; ++y) {
+            for (int x = origin.x(); x < origin.x() + _rect.width() - 1; ++x) {
+                h = hashMix(h, _image.pixel(x, y));
+            }
         }
     }
+    _hash = h;
+}
+
+void PackContent::trim(int alpha) {
+    int l, t, r, b;
+    alphaBounds(_image, alpha, l, t, r, b);
     _rect = QRect(QPoint(l, t), QPoint(r,b));
     if ((_rect.width() % 2) != (_image.width() % 2)) {
         if (l>0) l--; else r++;
@@ -73,6 +114,82 @@ void PackContent::trim(int alpha) {
     }
 }
 
+void PackContent::crop() {
+    if (_cropped) return;
+    if (_rect != QRect(QPoint(0, 0), _size)) {
+        _image = _image.copy(_rect);
+    }
+    _cropped = true;
+}
+
+void PackContent::setImage(const QImage& image) {
+    _image = image;
+    _cropped = false;
+    if (!_image.isNull()) crop();
+}
+
+void PackContent::save(QDataStream& stream, bool withPixels) const {
+    stream << _size << _rect << _hash;
+
+    stream << (quint32)_polygons.size();
+    for (const auto& polygon: _polygons) {
+        stream << (quint32)polygon.size();
+        for (const auto& point: polygon) {
+            stream << point;
+        }
+    }
+    stream << _triangles.verts << _triangles.indices;
+
+    bool hasPixels = withPixels && !_image.isNull();
+    stream << hasPixels;
+    if (hasPixels) {
+        stream << (qint32)_image.format();
+        int lineSize = _image.width() * _image.depth() / 8;
+        for (int y = 0; y < _image.height(); ++y) {
+            stream.writeRawData(reinterpret_cast<const char*>(_image.constScanLine(y)), lineSize);
+        }
+    }
+}
+
+bool PackContent::load(QDataStream& stream) {
+    stream >> _size >> _rect >> _hash;
+
+    quint32 polygonCount;
+    stream >> polygonCount;
+    _polygons.clear();
+    for (quint32 i = 0; (i < polygonCount) && (stream.status() == QDataStream::Ok); ++i) {
+        quint32 pointCount;
+        stream >> pointCount;
+        std::vector<QPointF> polygon;
+        for (quint32 j = 0; (j < pointCount) && (stream.status() == QDataStream::Ok); ++j) {
+            QPointF point;
+            stream >> point;
+            polygon.push_back(point);
+        }
+        _polygons.push_back(polygon);
+    }
+    _triangles = Triangles();
+    stream >> _triangles.verts >> _triangles.indices;
+
+    bool hasPixels = false;
+    stream >> hasPixels;
+    if (hasPixels && (stream.status() == QDataStream::Ok)) {
+        qint32 format;
+        stream >> format;
+        QImage image(_rect.size(), (QImage::Format)format);
+        if (image.isNull()) return false;
+
+        int lineSize = image.width() * image.depth() / 8;
+        for (int y = 0; y < image.height(); ++y) {
+            if (stream.readRawData(reinterpret_cast<char*>(image.scanLine(y)), lineSize) != lineSize) return false;
+        }
+        _image = image;
+        _cropped = true;
+    }
+
+    return stream.status() == QDataStream::Ok;
+}
+
 SpriteAtlas::SpriteAtlas(const QStringList& sourceList, int textureBorder, int spriteBorder, int trim, bool heuristicMask, bool pow2, bool forceSquared, int maxSize, float scale)
     : _sourceList(sourceList)
     , _trim(trim)
@@ -86,9 +203,19 @@ SpriteAtlas::SpriteAtlas(const QStringList& sourceList, int textureBorder, int s
 {
     _algorithm = "Rect";
     _rotateSprites = false;
+    _searchTimeLimit = 0;
     _polygonMode.enable = false;
-
-    _aborted = false;
+    _polygonMode.epsilon = 0;
+    _polygonMode.step = 5;
+    _polygonMode.candidates = 0;
+    _stableLayout.enable = false;
+    _stableLayout.wasteLimit = 0.15f;
+    _multiPage.balance = true;
+    _multiPage.fixedSize = false;
+    _preprocessCache.enable = PreprocessCache::isEnabled();
+    _preprocessCache.storePixels = PreprocessCache::storePixels();
+
+    _aborted.store(0);
 }
 
 void SpriteAtlas::enablePolygonMode(bool enable, float epsilon) {
@@ -96,8 +223,59 @@ void SpriteAtlas::enablePolygonMode(bool enable, float epsilon) {
     _polygonMode.epsilon = epsilon;
 }
 
+void SpriteAtlas::setPolygonSearch(int step, int candidates) {
+    _polygonMode.step = qMax(step, 1);
+    _polygonMode.candidates = qMax(candidates, 0);
+}
+
+void SpriteAtlas::setStableLayout(bool enable, float wasteLimit) {
+    _stableLayout.enable = enable;
+    _stableLayout.wasteLimit = wasteLimit;
+}
+
+void SpriteAtlas::setMultiPage(bool balance, bool fixedSize) {
+    _multiPage.balance = balance;
+    _multiPage.fixedSize = fixedSize;
+}
+
+void SpriteAtlas::setSourceStore(const QSharedPointer<SourceImageStore>& sourceStore) {
+    _sourceStore = sourceStore;
+    if (_sourceStore) {
+        _sourceStore->addScale(_scale);
+    }
+}
+
+void SpriteAtlas::enablePreprocessCache(bool enable, bool storePixels) {
+    _preprocessCache.enable = enable;
+    _preprocessCache.storePixels = storePixels;
+}
+
+QImage SpriteAtlas::loadImage(const QString& fileName) const {
+    QImage image = _sourceStore? _sourceStore->image(fileName, _scale) : SourceImageStore::scaled(QImage(fileName), _scale);
+    if (image.isNull()) return image;
+
+    if ((image.format() != QImage::Format_ARGB32) && (image.format() != QImage::Format_ARGB32_Premultiplied)) {
+        image = image.convertToFormat(QImage::Format_ARGB32);
+    }
+
+    // Apply Heuristic mask (same as QPixmap::setMask, but QPixmap is not safe outside the GUI thread)
+    if (_heuristicMask) {
+        QImage mask = image.createHeuristicMask().convertToFormat(QImage::Format_MonoLSB);
+        image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        for (int y = 0; y < image.height(); ++y) {
+            const uchar* maskLine = mask.constScanLine(y);
+            QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+            for (int x = 0; x < image.width(); ++x) {
+                if (!(maskLine[x >> 3] & (1 << (x & 7)))) line[x] = 0;
+            }
+        }
+    }
+
+    return image;
+}
+
 bool SpriteAtlas::generate(SpriteAtlasGenerateProgress* progress) {
-    _aborted = false;
+    _aborted.store(0);
 
     QTime timePerform;
     timePerform.start();
@@ -109,72 +287,93 @@ bool SpriteAtlas::generate(SpriteAtlasGenerateProgress* progress) {
     if (_progress)
         _progress->setProgressText(QString("Optimizing sprites..."));
 
-    QStringList nameFilter;
-    nameFilter << "*.png" << "*.jpg" << "*.jpeg" << "*.gif" << "*.bmp";
-
-    QList< QPair<QString, QString> > fileList;
-    for(auto pathName: _sourceList) {
-        if (_aborted) return false;
-
-        QFileInfo fi(pathName);
-
-        if (fi.isDir()) {
-            QDir dir(fi.path());
-            QDirIterator fileNames(pathName, nameFilter, QDir::Files | QDir::NoSymLinks | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
-            while(fileNames.hasNext()){
-                if (_aborted) return false;
-
-                fileNames.next();
-                fileList.push_back(qMakePair(fileNames.filePath(), dir.relativeFilePath(fileNames.filePath())));
-            }
-        } else {
-            fileList.push_back(qMakePair(pathName, fi.fileName()));
-        }
-    }
+    QList< QPair<QString, QString> > fileList = _sourceStore? _sourceStore->fileList(_sourceList) : SourceImageStore::listFiles(_sourceList);
+    if (_aborted.load()) return false;
 
     int skipSprites = 0;
 
     // init images and rects
     _identicalFrames.clear();
 
-    int progressIndex = 1;
-    QVector<PackContent> inputContent;
-    auto it_f = fileList.begin();
-    for(; it_f != fileList.end(); ++it_f, ++progressIndex) {
-        if (_aborted) return false;
-
-        QImage image((*it_f).first);
-        if (image.isNull()) continue;
-        if (_scale != 1) {
-            image = image.scaled(ceil(image.width() * _scale), ceil(image.height() * _scale), Qt::KeepAspectRatio, Qt::SmoothTransformation);
-        }
-        if (image.format() == QImage::Format_Indexed8) {
-            image = image.convertToFormat(QImage::Format_ARGB32);
-        }
-
-        // Apply Heuristic mask
-        if (_heuristicMask) {
-            QPixmap pix = QPixmap::fromImage(image);
-            pix.setMask(pix.createHeuristicMask());
-            image = pix.toImage();
+    // load, scale, trim and polygonize sprites in parallel, results keep the input order
+    PreprocessCache::Settings cacheSettings = { _scale, _trim, _heuristicMask, _polygonMode.enable, _polygonMode.epsilon, _sourceStore? _sourceStore->parentScale(_scale) : 1.f };
+    QAtomicInt progressIndex(0);
+    int progressCount = fileList.size();
+    auto reportProgress = [&]() {
+        if (_progress)
+            _progress->setProgressText(QString("Optimizing sprites: %1/%2").arg(progressIndex.fetchAndAddRelaxed(1) + 1).arg(progressCount));
+    };
+    // shared sources are released as soon as this variant has its pixels, the cached ones after the missing pixels are loaded
+    QMutex cachedFilesMutex;
+    QStringList cachedFiles;
+    std::function<PackContent (const QPair<QString, QString>&)> loadContent = [&](const QPair<QString, QString>& file) -> PackContent {
+        if (_aborted.load()) return PackContent(file.second, QImage());
+
+        // cached entries come without pixels unless the cache stores them, the pixels are loaded later if needed
+        QString cacheKey;
+        if (_preprocessCache.enable) {
+            cacheKey = PreprocessCache::key(file.first, cacheSettings);
+            PackContent packContent(file.second, QImage());
+            if (PreprocessCache::load(cacheKey, file.first, packContent)) {
+                if (_sourceStore) {
+                    QMutexLocker locker(&cachedFilesMutex);
+                    cachedFiles.push_back(file.first);
+                }
+                reportProgress();
+                return packContent;
+            }
         }
 
-        PackContent packContent((*it_f).second, image);
+        PackContent packContent(file.second, loadImage(file.first));
+        if (_sourceStore) _sourceStore->release(file.first);
 
         // Trim / Crop
-        if (_trim) {
+        if (_trim && !packContent.image().isNull()) {
             packContent.trim(_trim);
             if (_polygonMode.enable) {
-                //qDebug() << (*it_f).first;
                 PolygonImage polygonImage(packContent.image(), packContent.rect(), _polygonMode.epsilon, _trim);
                 packContent.setPolygons(polygonImage.polygons());
                 packContent.setTriangles(polygonImage.triangles());
             }
+            packContent.crop();
+        }
+        packContent.updateHash();
+
+        if (_preprocessCache.enable && !packContent.image().isNull()) {
+            PreprocessCache::save(cacheKey, file.first, packContent, _preprocessCache.storePixels);
+        }
+
+        reportProgress();
+
+        return packContent;
+    };
+    QFuture<PackContent> loadFuture = QtConcurrent::mapped(fileList, loadContent);
+    loadFuture.waitForFinished();
+    if (_aborted.load()) return false;
+
+    auto ensureImage = [this](PackContent& content, const QString& fileName) {
+        if (content.image().isNull()) {
+            content.setImage(loadImage(fileName));
         }
+    };
+
+    QList<PackContent> loadedContent = loadFuture.results();
+    QVector<PackContent> inputContent;
+    QVector<QString> inputFiles;
+    QHash<quint64, QVector<int>> contentIndex;
+    for (int i = 0; i < loadedContent.size(); ++i) {
+        PackContent& packContent = loadedContent[i];
+        if (packContent.size().isEmpty()) continue;
 
         // Find Identical
         bool findIdentical = false;
-        for (auto& content: inputContent) {
+        QVector<int>& candidates = contentIndex[packContent.hash()];
+        for (int index: candidates) {
+            PackContent& content = inputContent[index];
+            if (content.rect() != packContent.rect()) continue;
+
+            ensureImage(content, inputFiles[index]);
+            ensureImage(packContent, fileList[i].first);
             if (content.isIdentical(packContent)) {
                 findIdentical = true;
                 _identicalFrames[content.name()].push_back(packContent.name());
@@ -187,7 +386,26 @@ bool SpriteAtlas::generate(SpriteAtlasGenerateProgress* progress) {
             continue;
         }
 
+        candidates.push_back(inputContent.size());
         inputContent.push_back(packContent);
+        inputFiles.push_back(fileList[i].first);
+    }
+
+    // decode the pixels of cached sprites that are going to the atlas
+    QVector<int> missingImages;
+    for (int i = 0; i < inputContent.size(); ++i) {
+        if (inputContent[i].image().isNull()) missingImages.push_back(i);
+    }
+    if (!missingImages.isEmpty()) {
+        PackContent* contentData = inputContent.data();
+        std::function<void (int)> loadMissingImage = [&](int index) {
+            if (!_aborted.load()) ensureImage(contentData[index], inputFiles[index]);
+        };
+        QtConcurrent::blockingMap(missingImages, loadMissingImage);
+        if (_aborted.load()) return false;
+    }
+    for (auto fileName: cachedFiles) {
+        _sourceStore->release(fileName);
     }
     if (skipSprites)
         qDebug() << "Total skip sprites: " << skipSprites;
@@ -205,34 +423,156 @@ bool SpriteAtlas::generate(SpriteAtlasGenerateProgress* progress) {
     return result;
 }
 
-bool SpriteAtlas::packWithRect(const QVector<PackContent>& content) {
-    if (_progress)
-        _progress->setProgressText("Optimizing atlas...");
+QVector<bool> SpriteAtlas::generateVariants(QVector<SpriteAtlas>& atlases, int maxThreads, const QVector<SpriteAtlasGenerateProgress*>& progress, const std::function<bool ()>& aborted) {
+    QVector<bool> results(atlases.size(), false);
+
+    // own pool: the variants block on the QtConcurrent work they put on the global pool
+    QThreadPool pool;
+    pool.setMaxThreadCount((maxThreads > 0)? maxThreads : QThread::idealThreadCount());
+
+    SpriteAtlas* atlasData = atlases.data();
+    bool* resultData = results.data();
+    for (int i = 0; i < atlases.size(); ++i) {
+        SpriteAtlasGenerateProgress* atlasProgress = (i < progress.size())? progress[i] : nullptr;
+        QtConcurrent::run(&pool, [=]() {
+            if (aborted && aborted()) return;
+            resultData[i] = atlasData[i].generate(atlasProgress);
+        });
+    }
+    pool.waitForDone();
 
-    int volume = 0;
-    BinPack2D::ContentAccumulator<PackContent> inputContent;
-    for (auto packContent: content) {
-        int width = packContent.rect().width();
-        int height = packContent.rect().height();
-        volume += width * height * 1.02f;
+    return results;
+}
+
+int SpriteAtlas::variantThreads() {
+    QSettings settings;
+    return settings.value("Preferences/variantThreads", 4).toInt();
+}
 
-        inputContent += BinPack2D::Content<PackContent>(packContent,
-                                                        BinPack2D::Coord(),
-                                                        BinPack2D::Size(width + _spriteBorder, height + _spriteBorder),
-                                                        _rotateSprites,
-                                                        false);
+// The rect packers place plain index handles into the packed PackContent vector,
+// the sprites themselves are looked up only when the chosen layout is composed.
+typedef BinPack2D::Content<int> PackContentRect;
+typedef BinPack2D::ContentAccumulator<int> PackContentAccumulator;
+
+// Place the content on one width x height canvas with the selected rect algorithm.
+// The placed content is returned even when not everything fits.
+static bool placeContent(const QString& algorithm, int width, int height, const PackContentAccumulator& content, PackContentAccumulator& placedContent, PackContentAccumulator& remainder) {
+    bool success;
+    if (algorithm.startsWith("MaxRects")) {
+        RectPack2D::MaxRectsHeuristic heuristic = RectPack2D::BestShortSideFit;
+        if (algorithm == "MaxRects-BAF") {
+            heuristic = RectPack2D::BestAreaFit;
+        } else if (algorithm == "MaxRects-BL") {
+            heuristic = RectPack2D::BottomLeft;
+        } else if (algorithm == "MaxRects-CP") {
+            heuristic = RectPack2D::ContactPoint;
+        }
+        RectPack2D::CanvasArray<RectPack2D::MaxRectsBin, int> canvasArray(RectPack2D::MaxRectsBin(width, height, heuristic));
+        success = canvasArray.Place(content, remainder);
+        canvasArray.CollectContent(placedContent);
+    } else if (algorithm == "Skyline") {
+        RectPack2D::CanvasArray<RectPack2D::SkylineBin, int> canvasArray(RectPack2D::SkylineBin(width, height));
+        success = canvasArray.Place(content, remainder);
+        canvasArray.CollectContent(placedContent);
+    } else {
+        BinPack2D::CanvasArray<int> canvasArray(BinPack2D::UniformCanvasArrayBuilder<int>(width, height, 1).Build());
+        success = canvasArray.Place(content, remainder);
+        canvasArray.CollectContent(placedContent);
     }
+    return success;
+}
+
+// sort orders tried by the "Best" algorithm, the first one is the BinPack2D default
+static bool sortByArea(const PackContentRect& a, const PackContentRect& b) {
+    return a.size.w * a.size.h > b.size.w * b.size.h;
+}
 
-    // Sort the input content by size... usually packs better.
-    inputContent.Sort();
+static bool sortByMaxSide(const PackContentRect& a, const PackContentRect& b) {
+    int maxA = qMax(a.size.w, a.size.h);
+    int maxB = qMax(b.size.w, b.size.h);
+    if (maxA != maxB) return maxA > maxB;
+    return qMin(a.size.w, a.size.h) > qMin(b.size.w, b.size.h);
+}
+
+static bool sortByPerimeter(const PackContentRect& a, const PackContentRect& b) {
+    int perimeterA = a.size.w + a.size.h;
+    int perimeterB = b.size.w + b.size.h;
+    if (perimeterA != perimeterB) return perimeterA > perimeterB;
+    return sortByArea(a, b);
+}
+
+static bool sortByWidth(const PackContentRect& a, const PackContentRect& b) {
+    if (a.size.w != b.size.w) return a.size.w > b.size.w;
+    return a.size.h > b.size.h;
+}
+
+static bool sortByHeight(const PackContentRect& a, const PackContentRect& b) {
+    if (a.size.h != b.size.h) return a.size.h > b.size.h;
+    return a.size.w > b.size.w;
+}
+
+struct SpriteAtlas::RectLayout {
+    RectLayout(): width(0), height(0), hintWidth(0), hintHeight(0), fixedSize(false) { }
+
+    QString algorithm;
+    PackContentAccumulator input;       // sorted content to place
+    int width;
+    int height;
+    int hintWidth;                      // size to start the search from, e.g. of the cached layout, 0 - from the sprites volume
+    int hintHeight;
+    bool fixedSize;                     // place to the max texture size, no size search
+    PackContentAccumulator content;     // placed content
+    PackContentAccumulator remainder;   // content out of the max texture size
+    QString stableKey;                  // stable layout entry, saved once the page is accepted
+    LayoutCache::Entry stableEntry;
+};
+
+bool SpriteAtlas::layoutWithRect(RectLayout& layout, const std::function<bool ()>& cancelled) const {
+    const QString& algorithm = layout.algorithm;
+    const PackContentAccumulator& inputContent = layout.input;
+
+    int volume = 0;
+    qint64 area = 0;
+    int minSpriteWidth = 0;
+    int minSpriteHeight = 0;
+    for (auto itor = inputContent.Get().begin(); itor != inputContent.Get().end(); itor++ ) {
+        int spriteWidth = itor->size.w;
+        int spriteHeight = itor->size.h;
+        volume += (spriteWidth - _spriteBorder) * (spriteHeight - _spriteBorder) * 1.02f;
+
+        area += spriteWidth * spriteHeight;
+        if (_rotateSprites) {
+            minSpriteWidth = qMax(minSpriteWidth, qMin(spriteWidth, spriteHeight));
+            minSpriteHeight = qMax(minSpriteHeight, qMin(spriteWidth, spriteHeight));
+        } else {
+            minSpriteWidth = qMax(minSpriteWidth, spriteWidth);
+            minSpriteHeight = qMax(minSpriteHeight, spriteHeight);
+        }
+    }
 
     // A place to store packed content.
-    BinPack2D::ContentAccumulator<PackContent> remainder;
-    BinPack2D::ContentAccumulator<PackContent> outputContent;
+    PackContentAccumulator remainder;
+    PackContentAccumulator outputContent;
+
+    if (layout.fixedSize) {
+        if (cancelled()) return false;
+
+        placeContent(algorithm, _maxTextureSize - _textureBorder*2, _maxTextureSize - _textureBorder*2, inputContent, outputContent, remainder);
+        qDebug() << "Fixed size:" << _maxTextureSize << "x" << _maxTextureSize;
+        layout.width = _maxTextureSize;
+        layout.height = _maxTextureSize;
+        layout.content.Get().swap(outputContent.Get());
+        layout.remainder = remainder;
+        return true;
+    }
 
     // find optimal size for atlas
     int w = qMin(_maxTextureSize, (int)sqrt(volume));
     int h = qMin(_maxTextureSize, (int)sqrt(volume));
+    if (layout.hintWidth && layout.hintHeight) {
+        w = qMin(_maxTextureSize, layout.hintWidth);
+        h = qMin(_maxTextureSize, layout.hintHeight);
+    }
     if (_forceSquared) {
         h = w;
     }
@@ -241,38 +581,22 @@ bool SpriteAtlas::packWithRect(const QVector<PackContent>& content) {
         h = pow2(h);
         qDebug() << "Volume size:" << w << "x" << h;
 
+        bool maxSizeLimit = false;
         bool k = true;
         while (1) {
-            if (_aborted) return false;
-
-            BinPack2D::CanvasArray<PackContent> canvasArray = BinPack2D::UniformCanvasArrayBuilder<PackContent>(w - _textureBorder*2, h - _textureBorder*2, 1).Build();
+            if (cancelled()) return false;
 
-            bool success = canvasArray.Place(inputContent, remainder);
+            PackContentAccumulator placedContent;
+            bool success = placeContent(algorithm, w - _textureBorder*2, h - _textureBorder*2, inputContent, placedContent, remainder);
             if (success) {
-                outputContent = BinPack2D::ContentAccumulator<PackContent>();
-                canvasArray.CollectContent(outputContent);
+                outputContent = placedContent;
                 break;
             } else {
                 if ((w == _maxTextureSize) && (h == _maxTextureSize)) {
                     qDebug() << "Max size Limit!";
-                    //typedef BinPack2D::Content<PackContent>::Vector::iterator binpack2d_iterator;
-                    QVector<PackContent> remainderContent;
-                    for (auto itor = remainder.Get().begin(); itor != remainder.Get().end(); itor++ ) {
-                        const BinPack2D::Content<PackContent> &content = *itor;
-
-                        const PackContent &packContent = content.content;
-                        remainderContent.push_back(packContent);
-
-                        qDebug() << packContent.name() << content.size.w << content.size.h;
-                    }
-                    qDebug() << "content:" << content.size();
-                    qDebug() << "remainderContent:" << remainderContent.size();
-
-                    outputContent = BinPack2D::ContentAccumulator<PackContent>();
-                    canvasArray.CollectContent(outputContent);
-
-                    packWithRect(remainderContent);
-
+                    outputContent = placedContent;
+                    layout.remainder = remainder;
+                    maxSizeLimit = true;
                     break;
                 }
             }
@@ -288,16 +612,15 @@ bool SpriteAtlas::packWithRect(const QVector<PackContent>& content) {
             }
             qDebug() << "Resize for bigger:" << w << "x" << h;
         }
-        while (w > 2) {
-            if (_aborted) return false;
+        while ((w > 2) && !maxSizeLimit) {
+            if (cancelled()) return false;
 
             w = w/2;
             if (_forceSquared) {
                 h = w;
             }
-            BinPack2D::CanvasArray<PackContent> canvasArray = BinPack2D::UniformCanvasArrayBuilder<PackContent>(w - _textureBorder*2, h - _textureBorder*2, 1).Build();
-
-            bool success = canvasArray.Place(inputContent, remainder);
+            PackContentAccumulator placedContent;
+            bool success = placeContent(algorithm, w - _textureBorder*2, h - _textureBorder*2, inputContent, placedContent, remainder);
             if (!success) {
                 w = w*2;
                 if (_forceSquared) {
@@ -305,150 +628,497 @@ bool SpriteAtlas::packWithRect(const QVector<PackContent>& content) {
                 }
                 break;
             } else {
-                outputContent = BinPack2D::ContentAccumulator<PackContent>();
-                canvasArray.CollectContent(outputContent);
+                outputContent = placedContent;
             }
             qDebug() << "Optimize width:" << w << "x" << h;
         }
         if (!_forceSquared) {
-            while (h > 2) {
-                if (_aborted) return false;
+            while ((h > 2) && !maxSizeLimit) {
+                if (cancelled()) return false;
 
                 h = h/2;
-                BinPack2D::CanvasArray<PackContent> canvasArray = BinPack2D::UniformCanvasArrayBuilder<PackContent>(w - _textureBorder*2, h - _textureBorder*2, 1).Build();
-
-                bool success = canvasArray.Place(inputContent, remainder);
+                PackContentAccumulator placedContent;
+                bool success = placeContent(algorithm, w - _textureBorder*2, h - _textureBorder*2, inputContent, placedContent, remainder);
                 if (!success) {
                     h = h*2;
                     break;
                 } else {
-                    outputContent = BinPack2D::ContentAccumulator<PackContent>();
-                    canvasArray.CollectContent(outputContent);
+                    outputContent = placedContent;
                 }
                 qDebug() << "Optimize height:" << w << "x" << h;
             }
         }
     } else {
         qDebug() << "Volume size:" << w << "x" << h;
-        bool k = true;
-        int step = qMax((w + h) / 20, 1);
-        while (1) {
-            if (_aborted) return false;
+        const int border = _textureBorder*2;
+        QAtomicInt placeCount;
+        auto probe = [&](int probeWidth, int probeHeight, PackContentAccumulator& placedContent, PackContentAccumulator& remainderContent) -> bool {
+            placeCount.fetchAndAddRelaxed(1);
+            return placeContent(algorithm, probeWidth - border, probeHeight - border, inputContent, placedContent, remainderContent);
+        };
+
+        // upper bound: the size hint of the previous layout if everything still fits, else the max texture size
+        bool maxSizeLimit = false;
+        bool hinted = false;
+        if (layout.hintWidth && layout.hintHeight) {
+            PackContentAccumulator placedContent;
+            PackContentAccumulator remainderContent;
+            if (probe(w, h, placedContent, remainderContent)) {
+                outputContent = placedContent;
+                hinted = true;
+            }
+        }
+        if (!hinted) {
+            if (cancelled()) return false;
+
+            w = _maxTextureSize;
+            h = _maxTextureSize;
+            PackContentAccumulator placedContent;
+            if (!probe(w, h, placedContent, remainder)) {
+                qDebug() << "Max size Limit!";
+                layout.remainder = remainder;
+                maxSizeLimit = true;
+            }
+            outputContent = placedContent;
+        }
 
-            BinPack2D::CanvasArray<PackContent> canvasArray = BinPack2D::UniformCanvasArrayBuilder<PackContent>(w - _textureBorder*2, h - _textureBorder*2, 1).Build();
+        // Search for the smallest atlas below the upper bound. The canvas can't be less than
+        // the sprites area or the largest sprite, the probes of one round run in parallel.
+        if (!maxSizeLimit) {
+            const int minWidth = qMin(qMax(minSpriteWidth + border, 1), _maxTextureSize);
+            const int minHeight = qMax(minSpriteHeight + border, 1);
+            const int threadCount = qMax(QThread::idealThreadCount(), 4);
+            qDebug() << "Lower bound:" << minWidth << "x" << minHeight << "area:" << area;
+
+            struct SizeCandidate {
+                int w;
+                int h;
+                PackContentAccumulator content;
+            };
+            SizeCandidate best;
+            best.w = w;
+            best.h = h;
+            best.content = outputContent;
+
+            auto betterCandidate = [](const SizeCandidate& a, const SizeCandidate& b) -> bool {
+                if (!a.h) return false;
+                qint64 areaA = (qint64)a.w * a.h;
+                qint64 areaB = (qint64)b.w * b.h;
+                if (areaA != areaB) return areaA < areaB;
+                return qMax(a.w, a.h) < qMax(b.w, b.h);
+            };
+            // evenly spaced values in [from, to], at most count
+            auto spacedValues = [](int from, int to, int count) -> QVector<int> {
+                QVector<int> values;
+                for (int i = 0; i < count; ++i) {
+                    int value = from + (qint64)(to - from) * i / qMax(count - 1, 1);
+                    if (values.isEmpty() || (values.last() != value)) values.push_back(value);
+                }
+                return values;
+            };
 
-            bool success = canvasArray.Place(inputContent, remainder);
-            if (success) {
-                outputContent = BinPack2D::ContentAccumulator<PackContent>();
-                canvasArray.CollectContent(outputContent);
-                break;
+            if (_forceSquared) {
+                // k-ary search of the smallest side
+                int lo = qMin(qMax(qMax(minWidth, minHeight), (int)ceil(sqrt((double)area)) + border), best.w);
+                int hi = best.w;
+                std::function<SizeCandidate (int)> fitSquare = [&](int side) -> SizeCandidate {
+                    SizeCandidate candidate;
+                    candidate.w = side;
+                    candidate.h = 0;
+                    PackContentAccumulator remainderContent;
+                    if (!cancelled() && probe(side, side, candidate.content, remainderContent)) candidate.h = side;
+                    return candidate;
+                };
+                while (lo < hi) {
+                    QVector<int> sides = spacedValues(lo, hi - 1, threadCount);
+                    QList<SizeCandidate> candidates = QtConcurrent::blockingMapped<QList<SizeCandidate>>(sides, fitSquare);
+                    if (cancelled()) return false;
+
+                    int next = hi;
+                    for (int i = 0; i < candidates.size(); ++i) {
+                        if (candidates[i].h) {
+                            best = candidates[i];
+                            next = sides[i];
+                            break;
+                        }
+                        lo = sides[i] + 1;
+                    }
+                    hi = next;
+                    qDebug() << "Optimize side:" << lo << "-" << hi;
+                }
             } else {
-                if ((w == _maxTextureSize) && (h == _maxTextureSize)) {
-                    qDebug() << "Max size Limit!";
-                    //typedef BinPack2D::Content<PackContent>::Vector::iterator binpack2d_iterator;
-                    QVector<PackContent> remainderContent;
-                    for (auto itor = remainder.Get().begin(); itor != remainder.Get().end(); itor++ ) {
-                        const BinPack2D::Content<PackContent> &content = *itor;
+                // binary search of the smallest height for the width, only heights that can beat the best area of the previous round are probed
+                qint64 bestArea = (qint64)best.w * best.h;
+                std::function<SizeCandidate (int)> fitHeight = [&](int width) -> SizeCandidate {
+                    SizeCandidate candidate;
+                    candidate.w = width;
+                    candidate.h = 0;
+                    int lo = minHeight;
+                    if (width > border) lo = qMax(lo, (int)((area + (width - border) - 1) / (width - border)) + border);
+                    int hi = (int)qMin((qint64)_maxTextureSize, bestArea / width);
+                    PackContentAccumulator remainderContent;
+                    if ((lo > hi) || cancelled() || !probe(width, hi, candidate.content, remainderContent)) return candidate;
+                    while (lo < hi) {
+                        if (cancelled()) return candidate;
+
+                        int mid = (lo + hi) / 2;
+                        PackContentAccumulator placedContent;
+                        if (probe(width, mid, placedContent, remainderContent)) {
+                            hi = mid;
+                            candidate.content.Get().swap(placedContent.Get());
+                        } else {
+                            lo = mid + 1;
+                        }
+                    }
+                    candidate.h = hi;
+                    return candidate;
+                };
+
+                // sample widths around the ideal square, then refine around the best one
+                int from = minWidth;
+                int to = qMin(_maxTextureSize, qMax(from, 2 * (int)ceil(sqrt((double)area)) + border));
+                while (1) {
+                    QVector<int> widths = spacedValues(from, to, threadCount);
+                    QList<SizeCandidate> candidates = QtConcurrent::blockingMapped<QList<SizeCandidate>>(widths, fitHeight);
+                    if (cancelled()) return false;
+
+                    for (auto& candidate: candidates) {
+                        if (betterCandidate(candidate, best)) best = candidate;
+                    }
+                    bestArea = (qint64)best.w * best.h;
+                    qDebug() << "Optimize width:" << from << "-" << to << "best:" << best.w << "x" << best.h;
 
-                        const PackContent &packContent = content.content;
-                        remainderContent.push_back(packContent);
+                    int widthStep = (widths.size() > 1)? (to - from + widths.size() - 2) / (widths.size() - 1) : 0;
+                    if (widthStep <= 1) break;
+                    from = qMax(minWidth, best.w - widthStep + 1);
+                    to = qMin(_maxTextureSize, best.w + widthStep - 1);
+                }
+            }
+            w = best.w;
+            h = best.h;
+            outputContent = best.content;
+        }
+        qDebug() << "Place calls:" << placeCount.load();
+    }
 
-                        qDebug() << packContent.name() << content.size.w << content.size.h;
-                    }
-                    qDebug() << "content:" << content.size();
-                    qDebug() << "remainderContent:" << remainderContent.size();
+    layout.width = w;
+    layout.height = h;
+    layout.content.Get().swap(outputContent.Get());
+    return true;
+}
+
+// free area share of the canvas
+static float layoutWaste(int width, int height, const PackContentAccumulator& placedContent) {
+    if ((width <= 0) || (height <= 0)) return 1;
 
-                    outputContent = BinPack2D::ContentAccumulator<PackContent>();
-                    canvasArray.CollectContent(outputContent);
+    qint64 usedArea = 0;
+    for (const PackContentRect& contentRect: placedContent.Get()) {
+        usedArea += (qint64)contentRect.size.w * contentRect.size.h;
+    }
+    return 1 - usedArea / ((double)width * height);
+}
 
-                    packWithRect(remainderContent);
+// Keeps the previous placement of the sprites with unchanged size and puts the new or resized ones into the free space
+// of the previous atlas. Fails when something does not fit or the free space grew by more than wasteLimit.
+static bool stableLayout(const LayoutCache::Entry& previous, const QVector<PackContent>& content, const QVector<QSize>& sizes,
+                         int textureBorder, bool rotateSprites, float wasteLimit, PackContentAccumulator& placedContent) {
+    int width = previous.width - textureBorder*2;
+    int height = previous.height - textureBorder*2;
+    if ((width <= 0) || (height <= 0)) return false;
+
+    QHash<QString, LayoutCache::Rect> previousRects;
+    for (const LayoutCache::Rect& rect: previous.placed) {
+        if ((rect.index >= 0) && (rect.index < previous.names.size())) {
+            previousRects.insert(previous.names[rect.index], rect);
+        }
+    }
 
-                    break;
-                }
+    RectPack2D::MaxRectsBin bin(width, height);
+    QVector<int> newContent;
+    for (int i = 0; i < content.size(); ++i) {
+        auto it = previousRects.constFind(content[i].name());
+        if (it != previousRects.constEnd()) {
+            const LayoutCache::Rect& rect = it.value();
+            QSize size = rect.rotated? QSize(rect.h, rect.w) : QSize(rect.w, rect.h);
+            if ((size == sizes[i]) && (rect.x + rect.w <= width) && (rect.y + rect.h <= height)) {
+                bin.occupy(RectPack2D::Rect(rect.x, rect.y, rect.w, rect.h));
+                placedContent += PackContentRect(i, BinPack2D::Coord(rect.x, rect.y), BinPack2D::Size(rect.w, rect.h), rotateSprites, rect.rotated);
+                continue;
             }
-            if (k || _forceSquared) {
-                k = false;
-                w = qMin(w + step, _maxTextureSize);
-            } else {
-                k = true;
-                h = qMin(h + step, _maxTextureSize);;
+        }
+        newContent.push_back(i);
+    }
+
+    std::stable_sort(newContent.begin(), newContent.end(), [&sizes](int a, int b) -> bool {
+        return sizes[a].width() * sizes[a].height() > sizes[b].width() * sizes[b].height();
+    });
+    for (int index: newContent) {
+        RectPack2D::Rect rect;
+        bool rotated = false;
+        if (!bin.insert(sizes[index].width(), sizes[index].height(), rotateSprites, rect, rotated)) {
+            qDebug() << "Stable layout: no space for" << content[index].name();
+            return false;
+        }
+        placedContent += PackContentRect(index, BinPack2D::Coord(rect.x, rect.y), BinPack2D::Size(rect.w, rect.h), rotateSprites, rotated);
+    }
+
+    float waste = layoutWaste(width, height, placedContent);
+    qDebug() << "Stable layout: kept" << content.size() - newContent.size() << "placed" << newContent.size() << "waste:" << waste << "packed waste:" << previous.packedWaste;
+    return waste <= previous.packedWaste + wasteLimit;
+}
+
+bool SpriteAtlas::layoutRectPage(const QVector<PackContent>& content, int page, RectLayout& layout) {
+    if (_progress)
+        _progress->setProgressText("Optimizing atlas...");
+
+    PackContentAccumulator inputContent;
+    inputContent.Get().reserve(content.size());
+    for (int i = 0; i < content.size(); ++i) {
+        int width = content[i].rect().width();
+        int height = content[i].rect().height();
+
+        inputContent += PackContentRect(i,
+                                        BinPack2D::Coord(),
+                                        BinPack2D::Size(width + _spriteBorder, height + _spriteBorder),
+                                        _rotateSprites,
+                                        false);
+    }
+
+    // reuse the cached layout when the sprite sizes are unchanged, else start the search from its size
+    LayoutCache::Entry cachedLayout;
+    LayoutCache::Entry previousLayout;
+    QString layoutCacheKey;
+    QString stableLayoutKey;
+    bool layoutCached = false;
+    bool layoutStable = false;
+    int hintWidth = 0;
+    int hintHeight = 0;
+    QStringList names;
+    QVector<QSize> contentSizes;
+    if (!_layoutCacheFile.isEmpty()) {
+        for (const PackContent& packContent: content) {
+            names.push_back(packContent.name());
+        }
+        for (const PackContentRect& contentRect: inputContent.Get()) {
+            contentSizes.push_back(QSize(contentRect.size.w, contentRect.size.h));
+        }
+        LayoutCache::Settings layoutSettings = { _algorithm, _rotateSprites, _pow2, _forceSquared, _maxTextureSize, _textureBorder, _spriteBorder, _scale, layout.fixedSize };
+        layoutCacheKey = LayoutCache::key(names, layoutSettings);
+
+        if (_stableLayout.enable) {
+            stableLayoutKey = LayoutCache::stableKey(page, layoutSettings);
+            if (LayoutCache::load(_layoutCacheFile, stableLayoutKey, previousLayout)) {
+                layoutStable = stableLayout(previousLayout, content, contentSizes, _textureBorder, _rotateSprites, _stableLayout.wasteLimit, layout.content);
+                if (layoutStable) {
+                    layout.algorithm = previousLayout.algorithm;
+                    layout.width = previousLayout.width;
+                    layout.height = previousLayout.height;
+                } else {
+                    layout.content = PackContentAccumulator();
+                }
             }
-            if (_forceSquared) {
-                h = w;
+        }
+
+        if (!layoutStable && LayoutCache::load(_layoutCacheFile, layoutCacheKey, cachedLayout)) {
+            layoutCached = (cachedLayout.sizes == contentSizes);
+            for (const LayoutCache::Rect& rect: cachedLayout.placed + cachedLayout.remainder) {
+                if ((rect.index < 0) || (rect.index >= content.size())) layoutCached = false;
             }
+            hintWidth = cachedLayout.width;
+            hintHeight = cachedLayout.height;
+        }
+    }
 
-            qDebug() << "Resize for bigger:" << w << "x" << h << "step:" << step;
+    if (layoutStable) {
+        qDebug() << "Stable layout:" << layout.width << "x" << layout.height;
+    } else if (layoutCached) {
+        layout.algorithm = cachedLayout.algorithm;
+        layout.width = cachedLayout.width;
+        layout.height = cachedLayout.height;
+        for (const LayoutCache::Rect& rect: cachedLayout.placed) {
+            layout.content += PackContentRect(rect.index, BinPack2D::Coord(rect.x, rect.y), BinPack2D::Size(rect.w, rect.h), _rotateSprites, rect.rotated);
+        }
+        for (const LayoutCache::Rect& rect: cachedLayout.remainder) {
+            layout.remainder += PackContentRect(rect.index, BinPack2D::Coord(rect.x, rect.y), BinPack2D::Size(rect.w, rect.h), _rotateSprites, rect.rotated);
+        }
+        qDebug() << "Cached layout:" << layout.algorithm << layout.width << "x" << layout.height;
+    } else if (_algorithm == "Best") {
+        // pack with every rect algorithm and sort order, keep the smallest atlas
+        typedef bool (*SortFunction)(const PackContentRect&, const PackContentRect&);
+        QVector<SortFunction> sortFunctions = { sortByArea, sortByMaxSide, sortByPerimeter, sortByWidth, sortByHeight };
+        QStringList algorithms = { "Rect", "MaxRects-BSSF", "MaxRects-BAF", "MaxRects-BL", "MaxRects-CP", "Skyline" };
+
+        QVector<int> candidates;
+        for (int i = 0; i < algorithms.size() * sortFunctions.size(); ++i) {
+            candidates.push_back(i);
         }
-        step = qMax((w + h) / 20, 1);
-        while (w) {
-            if (_aborted) return false;
 
-            w -= step;
-            if (_forceSquared) {
-                h = w;
+        // the first candidate is always completed, the rest are dropped when the time is over
+        QElapsedTimer searchTime;
+        searchTime.start();
+        std::function<RectLayout (int)> packCandidate = [&](int index) -> RectLayout {
+            std::function<bool ()> cancelled = [&]() -> bool {
+                return _aborted.load() || (index && _searchTimeLimit && searchTime.hasExpired(_searchTimeLimit));
+            };
+
+            RectLayout candidate;
+            candidate.algorithm = algorithms[index / sortFunctions.size()];
+            candidate.hintWidth = hintWidth;
+            candidate.hintHeight = hintHeight;
+            candidate.fixedSize = layout.fixedSize;
+            if (cancelled()) return candidate;
+
+            candidate.input = inputContent;
+            candidate.input.Sort(sortFunctions[index % sortFunctions.size()]);
+            if (!layoutWithRect(candidate, cancelled)) {
+                candidate.width = 0;
+                candidate.height = 0;
             }
-            BinPack2D::CanvasArray<PackContent> canvasArray = BinPack2D::UniformCanvasArrayBuilder<PackContent>(w - _textureBorder*2, h - _textureBorder*2, 1).Build();
-
-            bool success = canvasArray.Place(inputContent, remainder);
-            if (!success) {
-                w += step;
-                if (_forceSquared) {
-                    h = w;
+            return candidate;
+        };
+        QList<RectLayout> candidateLayouts = QtConcurrent::blockingMapped<QList<RectLayout>>(candidates, packCandidate);
+        if (_aborted.load()) return false;
+
+        int best = -1;
+        for (int i = 0; i < candidateLayouts.size(); ++i) {
+            const RectLayout& candidate = candidateLayouts[i];
+            if (!candidate.width) continue;
+            if (best != -1) {
+                const RectLayout& bestLayout = candidateLayouts[best];
+                size_t remainderCount = candidate.remainder.Get().size();
+                size_t bestRemainderCount = bestLayout.remainder.Get().size();
+                qint64 area = (qint64)candidate.width * candidate.height;
+                qint64 bestArea = (qint64)bestLayout.width * bestLayout.height;
+                if (remainderCount > bestRemainderCount) continue;
+                if (remainderCount == bestRemainderCount) {
+                    if (area > bestArea) continue;
+                    if ((area == bestArea) && (qMax(candidate.width, candidate.height) >= qMax(bestLayout.width, bestLayout.height))) continue;
                 }
-                if (step > 1) step = qMax(step/2, 1); else break;
-            } else {
-                outputContent = BinPack2D::ContentAccumulator<PackContent>();
-                canvasArray.CollectContent(outputContent);
             }
-            qDebug() << "Optimize width:" << w << "x" << h << "step:" << step;
+            best = i;
         }
-        if (!_forceSquared) {
-            step = qMax((w + h) / 20, 1);
-            while (h) {
-                if (_aborted) return false;
+        if (best == -1) return false;
 
-                h -= step;
-                BinPack2D::CanvasArray<PackContent> canvasArray = BinPack2D::UniformCanvasArrayBuilder<PackContent>(w - _textureBorder*2, h - _textureBorder*2, 1).Build();
+        layout = candidateLayouts[best];
+        qDebug() << "Best algorithm:" << layout.algorithm << "sort:" << best % sortFunctions.size() << "search time:" << searchTime.elapsed() / 1000.f << "sec";
+    } else {
+        // Sort the input content by size... usually packs better.
+        inputContent.Sort();
+
+        layout.algorithm = _algorithm;
+        layout.input = inputContent;
+        layout.hintWidth = hintWidth;
+        layout.hintHeight = hintHeight;
+        std::function<bool ()> cancelled = [this]() -> bool { return _aborted.load(); };
+        if (!layoutWithRect(layout, cancelled)) return false;
+    }
 
-                bool success = canvasArray.Place(inputContent, remainder);
-                if (!success) {
-                    h += step;
-                    if (step > 1) step = qMax(step/2, 1); else break;
-                } else {
-                    outputContent = BinPack2D::ContentAccumulator<PackContent>();
-                    canvasArray.CollectContent(outputContent);
+    if (!layoutCacheKey.isEmpty() && (!layoutCached || !stableLayoutKey.isEmpty())) {
+        LayoutCache::Entry entry;
+        entry.algorithm = layout.algorithm;
+        entry.width = layout.width;
+        entry.height = layout.height;
+        entry.names = names;
+        entry.sizes = contentSizes;
+        for (const PackContentRect& contentRect: layout.content.Get()) {
+            LayoutCache::Rect rect = { contentRect.content, contentRect.coord.x, contentRect.coord.y, contentRect.size.w, contentRect.size.h, contentRect.rotated };
+            entry.placed.push_back(rect);
+        }
+        for (const PackContentRect& contentRect: layout.remainder.Get()) {
+            LayoutCache::Rect rect = { contentRect.content, contentRect.coord.x, contentRect.coord.y, contentRect.size.w, contentRect.size.h, contentRect.rotated };
+            entry.remainder.push_back(rect);
+        }
+        // a stable layout keeps the waste baseline of the last full repack
+        entry.packedWaste = layoutStable? previousLayout.packedWaste : layoutWaste(layout.width - _textureBorder*2, layout.height - _textureBorder*2, layout.content);
+
+        if (!layoutCached && !layoutStable) {
+            LayoutCache::save(_layoutCacheFile, layoutCacheKey, entry);
+        }
+        // the page may be a probe or a rejected balanced attempt, packWithRect saves the accepted pages only
+        if (!stableLayoutKey.isEmpty()) {
+            layout.stableKey = stableLayoutKey;
+            layout.stableEntry = entry;
+        }
+    }
+
+    return true;
+}
+
+// the atlas pixel QPainter draws with SourceOver to the transparent RGBA8888 atlas:
+// premultiplied source over nothing, stored unpremultiplied in the RGBA byte order
+static inline quint32 atlasPixel(QRgb pixel, bool premultiplied) {
+    if (!premultiplied) pixel = qPremultiply(pixel);
+    pixel = qUnpremultiply(pixel);
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    return (pixel << 8) | (pixel >> 24);
+#else
+    return (pixel & 0xff00ff00) | ((pixel & 0x00ff0000) >> 16) | ((pixel & 0x000000ff) << 16);
+#endif
+}
+
+// copies the sprite to the RGBA8888 atlas bits at pos, rotated like rotate90() and clipped to the atlas size
+static void copyToAtlas(const QImage& sprite, bool rotated, uchar* atlasBits, int bytesPerLine, const QSize& atlasSize, const QPoint& pos) {
+    QImage image = sprite;
+    if ((image.format() != QImage::Format_ARGB32) && (image.format() != QImage::Format_ARGB32_Premultiplied)) {
+        image = image.convertToFormat(QImage::Format_ARGB32);
+    }
+    bool premultiplied = (image.format() == QImage::Format_ARGB32_Premultiplied);
+
+    QSize size = rotated? image.size().transposed() : image.size();
+    QRect rect = QRect(pos, size).intersected(QRect(QPoint(0, 0), atlasSize));
+    if (!rotated) {
+        for (int y = rect.top(); y <= rect.bottom(); ++y) {
+            quint32* dst = reinterpret_cast<quint32*>(atlasBits + y * bytesPerLine) + rect.left();
+            const QRgb* src = reinterpret_cast<const QRgb*>(image.constScanLine(y - pos.y())) + (rect.left() - pos.x());
+            for (int x = rect.left(); x <= rect.right(); ++x) {
+                *dst++ = atlasPixel(*src++, premultiplied);
+            }
+        }
+        return;
+    }
+
+    // an atlas row is a sprite column read bottom up, walked in tiles so the sprite rows read stay in cache
+    const uchar* srcBits = image.constBits();
+    int srcStride = image.bytesPerLine();
+    for (int ty = rect.top(); ty <= rect.bottom(); ty += ImageTranspose::TileSize) {
+        int ye = qMin(ty + ImageTranspose::TileSize - 1, rect.bottom());
+        for (int tx = rect.left(); tx <= rect.right(); tx += ImageTranspose::TileSize) {
+            int xe = qMin(tx + ImageTranspose::TileSize - 1, rect.right());
+            for (int y = ty; y <= ye; ++y) {
+                quint32* dst = reinterpret_cast<quint32*>(atlasBits + y * bytesPerLine);
+                int column = y - pos.y();
+                for (int x = tx; x <= xe; ++x) {
+                    const QRgb* src = ImageTranspose::row(srcBits, srcStride, image.height() - 1 - (x - pos.x()));
+                    dst[x] = atlasPixel(src[column], premultiplied);
                 }
-                qDebug() << "Optimize height:" << w << "x" << h << "step:" << step;
             }
         }
     }
+}
+
+bool SpriteAtlas::composeRectPage(const QVector<PackContent>& content, const RectLayout& layout, OutputData& outputData) {
+    int w = layout.width;
+    int h = layout.height;
+    const PackContentAccumulator& outputContent = layout.content;
 
     qDebug() << "Found optimize size:" << w << "x" << h;
     if (_progress)
         _progress->setProgressText(QString("Found optimize size: %1x%2").arg(w).arg(h));
 
-    OutputData outputData;
+    const QVector<PackContent>& packContents = content;
 
     // parse output.
     outputData._atlasImage = QImage(w, h, QImage::Format_RGBA8888);
     outputData._atlasImage.fill(QColor(0, 0, 0, 0));
-    QPainter painter(&outputData._atlasImage);
     for(auto itor = outputContent.Get().begin(); itor != outputContent.Get().end(); itor++ ) {
-        if (_aborted) return false;
+        if (_aborted.load()) return false;
 
-        const BinPack2D::Content<PackContent> &content = *itor;
+        const PackContentRect &content = *itor;
 
         // retreive your data.
-        const PackContent &packContent = content.content;
+        const PackContent &packContent = packContents[content.content];
         //qDebug() << packContent.mName << packContent.mRect;
 
-        // image
-        QImage image;
-        if (content.rotated) {
-            image = packContent.image().copy(packContent.rect());
-            image = rotate90(image);
-        }
-
         SpriteFrameInfo spriteFrame;
         spriteFrame.triangles = packContent.triangles();
         spriteFrame.frame = QRect(content.coord.x + _textureBorder, content.coord.y + _textureBorder, content.size.w - _spriteBorder, content.size.h - _spriteBorder);
@@ -459,23 +1129,17 @@ bool SpriteAtlas::packWithRect(const QVector<PackContent>& content) {
                         );
         } else {
             spriteFrame.offset = QPoint(
-                        (packContent.rect().left() + (-packContent.image().width() + content.size.w - _spriteBorder) * 0.5f),
-                        (-packContent.rect().top() + ( packContent.image().height() - content.size.h + _spriteBorder) * 0.5f)
+                        (packContent.rect().left() + (-packContent.size().width() + content.size.w - _spriteBorder) * 0.5f),
+                        (-packContent.rect().top() + ( packContent.size().height() - content.size.h + _spriteBorder) * 0.5f)
                         );
         }
         spriteFrame.rotated = content.rotated;
         spriteFrame.sourceColorRect = packContent.rect();
-        spriteFrame.sourceSize = packContent.image().size();
+        spriteFrame.sourceSize = packContent.size();
         if (content.rotated) {
             spriteFrame.frame = QRect(content.coord.x, content.coord.y, content.size.h-_spriteBorder, content.size.w-_spriteBorder);
 
         }
-        if (content.rotated) {
-            painter.drawImage(QPoint(content.coord.x + _textureBorder, content.coord.y + _textureBorder), image);
-        } else {
-            painter.drawImage(QPoint(content.coord.x + _textureBorder, content.coord.y + _textureBorder), packContent.image(), packContent.rect());
-        }
-
         outputData._spriteFrames[packContent.name()] = spriteFrame;
 
         // add ident to sprite frames
@@ -490,9 +1154,157 @@ bool SpriteAtlas::packWithRect(const QVector<PackContent>& content) {
         }
     }
 
-    painter.end();
-    _outputData.push_front(outputData);
+    // the sprite rects don't overlap, every sprite is copied to the atlas by its own thread
+    QSize atlasSize = outputData._atlasImage.size();
+    int bytesPerLine = outputData._atlasImage.bytesPerLine();
+    uchar* atlasBits = outputData._atlasImage.bits();
+    QVector<int> sprites;
+    for (int i = 0; i < (int)outputContent.Get().size(); ++i) {
+        sprites.push_back(i);
+    }
+    std::function<void (int)> copySprite = [&](int index) {
+        if (_aborted.load()) return;
+        const PackContentRect &content = outputContent.Get()[index];
+        copyToAtlas(packContents[content.content].image(), content.rotated, atlasBits, bytesPerLine, atlasSize,
+                    QPoint(content.coord.x + _textureBorder, content.coord.y + _textureBorder));
+    };
+    QtConcurrent::blockingMap(sprites, copySprite);
+    if (_aborted.load()) return false;
+
+    return true;
+}
+
+bool SpriteAtlas::packWithRect(const QVector<PackContent>& content) {
+    QVector<QVector<PackContent>> pageContents;
+    QVector<RectLayout> pageLayouts;
+
+    RectLayout layout;
+    if (!layoutRectPage(content, 0, layout)) return false;
+    pageContents.push_back(content);
+    pageLayouts.push_back(layout);
+
+    if (!layout.remainder.Get().empty()) {
+        qint64 totalArea = 0;
+        qint64 placedArea = 0;
+        for (const PackContentRect& contentRect: layout.content.Get()) {
+            placedArea += (qint64)contentRect.size.w * contentRect.size.h;
+        }
+        totalArea = placedArea;
+        for (const PackContentRect& contentRect: layout.remainder.Get()) {
+            totalArea += (qint64)contentRect.size.w * contentRect.size.h;
+        }
+        if (!placedArea) {
+            qDebug() << "No sprite fits the max texture size:" << _maxTextureSize;
+            return false;
+        }
+
+        // the first page filled to the max size estimates the page count, the sprites are spread over the pages
+        // with the same area each and the pages are packed in parallel, the last page is no more a leftover
+        int pageCount = qMax(2, (int)((totalArea + placedArea - 1) / placedArea));
+        bool balanced = _multiPage.balance && packBalancedPages(content, pageCount, pageContents, pageLayouts);
+        if (!balanced) {
+            // greedy pages: every page takes what overflows the previous one
+            while (!pageLayouts.last().remainder.Get().empty()) {
+                if (_aborted.load()) return false;
+
+                QVector<PackContent> remainderContent;
+                for (const PackContentRect& contentRect: pageLayouts.last().remainder.Get()) {
+                    const PackContent &packContent = pageContents.last()[contentRect.content];
+                    remainderContent.push_back(packContent);
+
+                    qDebug() << packContent.name() << contentRect.size.w << contentRect.size.h;
+                }
+                qDebug() << "content:" << pageContents.last().size();
+                qDebug() << "remainderContent:" << remainderContent.size();
+
+                RectLayout remainderLayout;
+                remainderLayout.fixedSize = _multiPage.fixedSize;
+                if (!layoutRectPage(remainderContent, pageLayouts.size(), remainderLayout)) return false;
+                if (remainderLayout.content.Get().empty()) {
+                    qDebug() << "No sprite fits the max texture size:" << _maxTextureSize;
+                    return false;
+                }
+                pageContents.push_back(remainderContent);
+                pageLayouts.push_back(remainderLayout);
+            }
+
+            // the greedy pages show the real page count, spread the sprites once more if the estimate was too low
+            if (_multiPage.balance && (pageLayouts.size() > pageCount)) {
+                QVector<QVector<PackContent>> balancedContents;
+                QVector<RectLayout> balancedLayouts;
+                if (packBalancedPages(content, pageLayouts.size(), balancedContents, balancedLayouts)) {
+                    pageContents = balancedContents;
+                    pageLayouts = balancedLayouts;
+                }
+            }
+        }
+        qDebug() << "Pages:" << pageLayouts.size() << (balanced? "balanced" : "");
+    }
+    if (_aborted.load()) return false;
+
+    for (int i = 0; i < pageLayouts.size(); ++i) {
+        OutputData outputData;
+        if (!composeRectPage(pageContents[i], pageLayouts[i], outputData)) return false;
+        _outputData.push_back(outputData);
+    }
+
+    for (const RectLayout& pageLayout: pageLayouts) {
+        if (!pageLayout.stableKey.isEmpty()) {
+            LayoutCache::save(_layoutCacheFile, pageLayout.stableKey, pageLayout.stableEntry);
+        }
+    }
+
+    return true;
+}
+
+bool SpriteAtlas::packBalancedPages(const QVector<PackContent>& content, int pageCount, QVector<QVector<PackContent>>& pageContents, QVector<RectLayout>& pageLayouts) {
+    if (_progress)
+        _progress->setProgressText(QString("Balancing %1 pages...").arg(pageCount));
+
+    // largest sprites first, each one to the page with the least area so far
+    QVector<int> order;
+    QVector<qint64> areas;
+    for (int i = 0; i < content.size(); ++i) {
+        order.push_back(i);
+        areas.push_back((qint64)(content[i].rect().width() + _spriteBorder) * (content[i].rect().height() + _spriteBorder));
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return areas[a] > areas[b];
+    });
+
+    QVector<QVector<PackContent>> balancedContents(pageCount);
+    QVector<qint64> pageAreas(pageCount, 0);
+    for (int index: order) {
+        int page = 0;
+        for (int i = 1; i < pageCount; ++i) {
+            if (pageAreas[i] < pageAreas[page]) page = i;
+        }
+        balancedContents[page].push_back(content[index]);
+        pageAreas[page] += areas[index];
+    }
+
+    QVector<int> pages;
+    for (int i = 0; i < pageCount; ++i) {
+        pages.push_back(i);
+    }
+    QVector<bool> pageResults(pageCount, false);
+    QVector<RectLayout> balancedLayouts(pageCount);
+    std::function<void (int)> layoutPage = [&](int page) {
+        balancedLayouts[page].fixedSize = _multiPage.fixedSize;
+        pageResults[page] = layoutRectPage(balancedContents[page], page, balancedLayouts[page]);
+    };
+    QtConcurrent::blockingMap(pages, layoutPage);
+    if (_aborted.load()) return false;
+
+    for (int i = 0; i < pageCount; ++i) {
+        if (!pageResults[i] || !balancedLayouts[i].remainder.Get().empty()) {
+            qDebug() << "Balanced pages:" << pageCount << "page" << i << "overflows";
+            return false;
+        }
+    }
 
+    pageContents = balancedContents;
+    pageLayouts = balancedLayouts;
     return true;
 }
 
@@ -520,8 +1332,8 @@ bool SpriteAtlas::packWithPolygon(const QVector<PackContent>& content) {
     }
 
     PolyPack2D::Container<PackContent> container;
-    // TODO: abort this place if _aborted
-    container.place(inputContent, _maxTextureSize, 5, std::bind(&SpriteAtlas::onPlaceCallback, this, std::placeholders::_1, std::placeholders::_2));
+    container.place(inputContent, _maxTextureSize, _polygonMode.step, _polygonMode.candidates, std::bind(&SpriteAtlas::onPlaceCallback, this, std::placeholders::_1, std::placeholders::_2), [this]() -> bool { return _aborted.load(); });
+    if (_aborted.load()) return false;
 
     auto outputContent = container.contentList();
 
@@ -532,7 +1344,7 @@ bool SpriteAtlas::packWithPolygon(const QVector<PackContent>& content) {
 
     QPainter painter(&outputData._atlasImage);
     for(auto itor = outputContent.begin(); itor != outputContent.end(); itor++ ) {
-        if (_aborted) return false;
+        if (_aborted.load()) return false;
 
         const PolyPack2D::Content<PackContent> &content = *itor;
 
@@ -548,7 +1360,7 @@ bool SpriteAtlas::packWithPolygon(const QVector<PackContent>& content) {
                     );
         spriteFrame.rotated = false;
         spriteFrame.sourceColorRect = packContent.rect();
-        spriteFrame.sourceSize = packContent.image().size();
+        spriteFrame.sourceSize = packContent.size();
 
         QPainterPath clipPath;
         for (auto polygon: packContent.polygons()) {
@@ -556,7 +1368,7 @@ bool SpriteAtlas::packWithPolygon(const QVector<PackContent>& content) {
         }
         clipPath.translate(content.bounds().left + _textureBorder, content.bounds().top + _textureBorder);
         painter.setClipPath(clipPath);
-        painter.drawImage(QPoint(content.bounds().left + _textureBorder, content.bounds().top + _textureBorder), packContent.image(), packContent.rect());
+        painter.drawImage(QPoint(content.bounds().left + _textureBorder, content.bounds().top + _textureBorder), packContent.image());
 
         outputData._spriteFrames[packContent.name()] = spriteFrame;
 
@@ -3,9 +3,12 @@
 
 #include <QtCore>
 #include <QImage>
+#include <functional>
 
 #include "PolygonImage.h"
 
+class SourceImageStore;
+
 struct SpriteFrameInfo {
 public:
     QRect   frame;
@@ -17,26 +20,40 @@ public:
     Triangles triangles;
 };
 
+// Sprite to pack. After crop() only the pixels of rect() are kept, image() is then rect().size() big
+// and size() is still the size of the source image.
 class PackContent {
 public:
     PackContent();
     PackContent(const QString& name, const QImage& image);
 
-    bool isIdentical(const PackContent& other);
+    bool isIdentical(const PackContent& other) const;
     void trim(int alpha);
+    void crop();
+    void updateHash();
+    // source image pixels, cropped to rect()
+    void setImage(const QImage& image);
     void setTriangles(const Triangles& triangles) { _triangles = triangles; }
     void setPolygons(const Polygons& polygons) { _polygons = polygons; }
 
     const QString& name() const { return _name; }
     const QImage& image() const { return _image; }
+    const QSize& size() const { return _size; }
     const QRect& rect() const { return _rect; }
+    quint64 hash() const { return _hash; }
     const Triangles& triangles() const { return _triangles; }
     const Polygons& polygons() const { return _polygons; }
 
+    void save(QDataStream& stream, bool withPixels) const;
+    bool load(QDataStream& stream);
+
 private:
     QString _name;
     QImage  _image;
+    QSize   _size;
     QRect   _rect;
+    bool    _cropped;
+    quint64 _hash;
     Triangles _triangles;
     Polygons  _polygons;
 };
@@ -77,11 +94,36 @@ public:
 
     void setAlgorithm(const QString& algorithm) { _algorithm = algorithm; }
     void enablePolygonMode(bool enable, float epsilon = 2.f);
+    // polygon placement: coarse search step and number of the best positions refined with 1px step
+    void setPolygonSearch(int step, int candidates);
+    void enablePreprocessCache(bool enable, bool storePixels = false);
+    // file of the rect layouts reused by the next build, empty - disabled
+    void setLayoutCache(const QString& fileName) { _layoutCacheFile = fileName; }
+    // stable layout keeps the placement of the previous build (needs the layout cache) and places only new or resized
+    // sprites, the atlas is fully repacked when its free area share grows by more than wasteLimit
+    void setStableLayout(bool enable, float wasteLimit = 0.15f);
+    // sprites overflowing the max texture size: balance - spread them over the fewest pages with an even fill,
+    // else every page is filled up before the next one; fixedSize - every page gets the max texture size
+    void setMultiPage(bool balance, bool fixedSize);
+    // decoded sources shared with the other scaling variants of the build
+    void setSourceStore(const QSharedPointer<SourceImageStore>& sourceStore);
 
     void setRotateSprites(bool value) { _rotateSprites = value; }
+    // time limit of the "Best" algorithm search in msec, 0 - unlimited
+    void setSearchTimeLimit(int msec) { _searchTimeLimit = msec; }
 
     bool generate(SpriteAtlasGenerateProgress* progress = nullptr);
-    void abortGeneration() { _aborted = true; }
+    void abortGeneration() { _aborted.store(1); }
+
+    // Generates independent atlases (the scaling variants of one build) on a pool of maxThreads threads,
+    // 0 - one per core. Variants not started yet are skipped once aborted() returns true.
+    // Returns the result of every atlas.
+    static QVector<bool> generateVariants(QVector<SpriteAtlas>& atlases,
+                                          int maxThreads,
+                                          const QVector<SpriteAtlasGenerateProgress*>& progress = QVector<SpriteAtlasGenerateProgress*>(),
+                                          const std::function<bool ()>& aborted = nullptr);
+    // user preferences
+    static int variantThreads();
 
     QString algorithm() const { return _algorithm; }
     float scale() const { return _scale; }
@@ -90,6 +132,13 @@ public:
     const QMap<QString, QVector<QString>>& identicalFrames() const { return _identicalFrames; }
 
 protected:
+    QImage loadImage(const QString& fileName) const;
+
+    struct RectLayout;
+    bool layoutWithRect(RectLayout& layout, const std::function<bool ()>& cancelled) const;
+    bool layoutRectPage(const QVector<PackContent>& content, int page, RectLayout& layout);
+    bool composeRectPage(const QVector<PackContent>& content, const RectLayout& layout, OutputData& outputData);
+    bool packBalancedPages(const QVector<PackContent>& content, int pageCount, QVector<QVector<PackContent>>& pageContents, QVector<RectLayout>& pageLayouts);
     bool packWithRect(const QVector<PackContent>& content);
     bool packWithPolygon(const QVector<PackContent>& content);
 
@@ -107,11 +156,29 @@ private:
     int _maxTextureSize;
     float _scale;
     bool _rotateSprites;
+    int _searchTimeLimit;
     // polygon mode
     struct TPolygonMode{
         bool enable;
         float epsilon;
+        int step;
+        int candidates;
     } _polygonMode;
+    // on-disk preprocess cache
+    struct TPreprocessCache {
+        bool enable;
+        bool storePixels;
+    } _preprocessCache;
+    QSharedPointer<SourceImageStore> _sourceStore;
+    QString _layoutCacheFile;
+    struct TStableLayout {
+        bool enable;
+        float wasteLimit;
+    } _stableLayout;
+    struct TMultiPage {
+        bool balance;
+        bool fixedSize;
+    } _multiPage;
 
     SpriteAtlasGenerateProgress* _progress;
 
@@ -119,7 +186,7 @@ private:
     QVector<OutputData> _outputData;
     QMap<QString, QVector<QString>> _identicalFrames;
 
-    bool _aborted;
+    QAtomicInt _aborted;
 };
 
 #endif // SPRITEATLAS_H
@@ -12,8 +12,14 @@ SpritePackerProjectFile::SpritePackerProjectFile() {
     _trimMode = "Rect";
     _trimThreshold = 1;
     _epsilon = 5;
+    _searchTime = 0;
+    _polygonStep = 5;
+    _polygonCandidates = 0;
     _heuristicMask = false;
     _rotateSprites = false;
+    _stableLayout = false;
+    _balancePages = true;
+    _fixedPageSize = false;
     _textureBorder = 0;
     _spriteBorder = 2;
     _imageFormat = kPNG,
@@ -21,6 +27,7 @@ SpritePackerProjectFile::SpritePackerProjectFile() {
     _premultiplied = true;
     _pngOptMode = "None";
     _pngOptLevel = 7;
+    _pngSharedPalette = false;
     _jpgQuality = 80;
     _webpQuality = 80;
 
@@ -48,8 +55,14 @@ bool SpritePackerProjectFile::read(const QString &fileName) {
     if (json.contains("trimMode")) _trimMode = json["trimMode"].toString();
     if (json.contains("trimThreshold")) _trimThreshold = json["trimThreshold"].toInt();
     if (json.contains("epsilon")) _epsilon = json["epsilon"].toDouble();
+    if (json.contains("searchTime")) _searchTime = json["searchTime"].toDouble();
+    if (json.contains("polygonStep")) _polygonStep = json["polygonStep"].toInt();
+    if (json.contains("polygonCandidates")) _polygonCandidates = json["polygonCandidates"].toInt();
     if (json.contains("heuristicMask")) _heuristicMask = json["heuristicMask"].toBool();
     if (json.contains("rotateSprites")) _rotateSprites = json["rotateSprites"].toBool();
+    if (json.contains("stableLayout")) _stableLayout = json["stableLayout"].toBool();
+    if (json.contains("balancePages")) _balancePages = json["balancePages"].toBool();
+    if (json.contains("fixedPageSize")) _fixedPageSize = json["fixedPageSize"].toBool();
     if (json.contains("textureBorder")) _textureBorder = json["textureBorder"].toInt();
     if (json.contains("spriteBorder")) _spriteBorder = json["spriteBorder"].toInt();
     if (json.contains("imageFormat")) _imageFormat = imageFormatFromString(json["imageFormat"].toString());
@@ -57,6 +70,7 @@ bool SpritePackerProjectFile::read(const QString &fileName) {
     if (json.contains("premultiplied")) _premultiplied = json["premultiplied"].toBool();
     if (json.contains("pngOptMode")) _pngOptMode = json["pngOptMode"].toString();
     if (json.contains("pngOptLevel")) _pngOptLevel = json["pngOptLevel"].toInt();
+    if (json.contains("pngSharedPalette")) _pngSharedPalette = json["pngSharedPalette"].toBool();
     if (json.contains("webpQuality")) _webpQuality = json["webpQuality"].toInt();
     if (json.contains("jpgQuality")) _jpgQuality = json["jpgQuality"].toInt();
 
@@ -100,8 +114,14 @@ bool SpritePackerProjectFile::write(const QString &fileName) {
     json["trimMode"] = _trimMode;
     json["trimThreshold"] = _trimThreshold;
     json["epsilon"] = _epsilon;
+    json["searchTime"] = _searchTime;
+    json["polygonStep"] = _polygonStep;
+    json["polygonCandidates"] = _polygonCandidates;
     json["heuristicMask"] = _heuristicMask;
     json["rotateSprites"] = _rotateSprites;
+    json["stableLayout"] = _stableLayout;
+    json["balancePages"] = _balancePages;
+    json["fixedPageSize"] = _fixedPageSize;
     json["textureBorder"] = _textureBorder;
     json["spriteBorder"] = _spriteBorder;
     json["imageFormat"] = imageFormatToString(_imageFormat);
@@ -109,6 +129,7 @@ bool SpritePackerProjectFile::write(const QString &fileName) {
     json["premultiplied"] = _premultiplied;
     json["pngOptMode"] = _pngOptMode;
     json["pngOptLevel"] = _pngOptLevel;
+    json["pngSharedPalette"] = _pngSharedPalette;
     json["webpQuality"] = _webpQuality;
     json["jpgQuality"] = _jpgQuality;
 
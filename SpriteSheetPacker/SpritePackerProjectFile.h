@@ -31,12 +31,29 @@ public:
     void setEpsilon(float epsilon) { _epsilon = epsilon; }
     float epsilon() const { return _epsilon; }
 
+    // time limit of the "Best" algorithm search in seconds, 0 - unlimited
+    void setSearchTime(float seconds) { _searchTime = seconds; }
+    float searchTime() const { return _searchTime; }
+
+    void setPolygonStep(int step) { _polygonStep = step; }
+    int polygonStep() const { return _polygonStep; }
+
+    void setPolygonCandidates(int candidates) { _polygonCandidates = candidates; }
+    int polygonCandidates() const { return _polygonCandidates; }
+
     void setHeuristicMask(bool heuristicMask) { _heuristicMask = heuristicMask; }
     bool heuristicMask() const { return _heuristicMask; }
 
     void setRotateSprites(bool rotate) { _rotateSprites = rotate; }
     bool rotateSprites() { return _rotateSprites; }
 
+    void setStableLayout(bool stable) { _stableLayout = stable; }
+    bool stableLayout() const { return _stableLayout; }
+    void setBalancePages(bool balance) { _balancePages = balance; }
+    bool balancePages() const { return _balancePages; }
+    void setFixedPageSize(bool fixed) { _fixedPageSize = fixed; }
+    bool fixedPageSize() const { return _fixedPageSize; }
+
     void setTextureBorder(int textureBorder) { _textureBorder = textureBorder; }
     int textureBorder() const { return _textureBorder; }
 
@@ -58,6 +75,9 @@ public:
     void setPngOptLevel(int optLevel) { _pngOptLevel = optLevel; }
     int pngOptLevel() const { return _pngOptLevel; }
 
+    void setPngSharedPalette(bool shared) { _pngSharedPalette = shared; }
+    bool pngSharedPalette() const { return _pngSharedPalette; }
+
     void setWebpQuality(int quality) { _webpQuality = quality; }
     int webpQuality() const { return _webpQuality; }
 
@@ -100,8 +120,14 @@ protected:
     QString     _trimMode;
     int         _trimThreshold;
     float       _epsilon;
+    float       _searchTime;
+    int         _polygonStep;
+    int         _polygonCandidates;
     bool        _heuristicMask;
     bool        _rotateSprites;
+    bool        _stableLayout;
+    bool        _balancePages;
+    bool        _fixedPageSize;
     int         _textureBorder;
     int         _spriteBorder;
     ImageFormat _imageFormat;
@@ -110,6 +136,7 @@ protected:
 
     QString     _pngOptMode;
     int         _pngOptLevel;
+    bool        _pngSharedPalette;
     int         _webpQuality;
     int         _jpgQuality;
 
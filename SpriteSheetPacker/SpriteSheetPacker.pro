@@ -47,10 +47,16 @@ SOURCES += main.cpp\
     ContentProtectionDialog.cpp \
     ZoomGraphicsView.cpp \
     AnimationDialog.cpp \
-    ElapsedTimer.cpp
+    ElapsedTimer.cpp \
+    ImageTrim.cpp \
+    PreprocessCache.cpp \
+    SourceImageStore.cpp \
+    LayoutCache.cpp
 
 HEADERS += MainWindow.h \
     ImageRotate.h \
+    ImageTranspose.h \
+    ImageTrim.h \
     SpriteAtlas.h \
     ScalingVariantWidget.h \
     SpritePackerProjectFile.h \
@@ -68,14 +74,18 @@ HEADERS += MainWindow.h \
     ContentProtectionDialog.h \
     ZoomGraphicsView.h \
     AnimationDialog.h \
-    ElapsedTimer.h
+    ElapsedTimer.h \
+    PreprocessCache.h \
+    SourceImageStore.h \
+    LayoutCache.h
 
 #algorithm
 INCLUDEPATH += algorithm
 
 HEADERS += algorithm/binpack2d.hpp \
     algorithm/triangle_triangle_intersection.h \
-    algorithm/polypack2d.h
+    algorithm/polypack2d.h \
+    algorithm/rectpack2d.h
 
 SOURCES += algorithm/polypack2d.cpp
 
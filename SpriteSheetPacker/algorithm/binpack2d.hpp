@@ -139,9 +139,11 @@
 #include<vector>
 #include<map>
 #include<list>
+#include<set>
 #include<algorithm>
 #include<math.h>
 #include<sstream>
+#include<utility>
 
 namespace BinPack2D {
 
@@ -215,14 +217,6 @@ namespace BinPack2D {
         /*const*/ Size  size;
         /*const*/ _T content;
 
-        Content( const Content<_T> &src )
-        : tryRotate(src.tryRotate),
-        rotated(src.rotated),
-        coord(src.coord),
-        size(src.size),
-        content(src.content)
-        {}
-
         Content( const _T &content, const Coord &coord, const Size &size, bool tryRotate, bool rotated )
         : tryRotate(tryRotate),
         rotated(rotated),
@@ -259,10 +253,32 @@ namespace BinPack2D {
 
     template<typename _T> class Canvas {
 
-        Coord::List topLefts;
+        // Free top lefts ordered by the distance to the origin. Equal distances keep the order of the stable sorted
+        // list this used to be: the top lefts pushed to the front newest first, then the ones pushed to the back.
+        struct TopLeft {
+
+            float distance;
+            long long order;
+            Coord coord;
+
+            bool operator < ( const TopLeft &that ) const {
+
+                if(this->distance != that.distance) return this->distance < that.distance;
+                return this->order < that.order;
+            }
+        };
+
+        std::set<TopLeft> topLefts;
+        long long frontOrder;
+        long long backOrder;
+
         typename Content<_T>::Vector contentVector;
 
-        bool needToSort;
+        // coarse occupancy grid, every cell lists the placed content overlapping it
+        enum { CellSize = 64 };
+        int gridW;
+        int gridH;
+        std::vector< std::vector<int> > grid;
 
     public:
 
@@ -271,17 +287,25 @@ namespace BinPack2D {
 
         static bool Place( Vector &canvasVector, const typename Content<_T>::Vector &contentVector, typename Content<_T>::Vector &remainder ) {
 
-            typename Content<_T>::Vector todo = contentVector;
+            // the content left by one canvas goes to the next one, swapped instead of copied
+            const typename Content<_T>::Vector *input = &contentVector;
+            typename Content<_T>::Vector todo;
 
             for( typename Vector::iterator itor = canvasVector.begin(); itor != canvasVector.end(); itor++ ) {
 
                 Canvas <_T> &canvas = *itor;
 
                 remainder.clear();
-                canvas.Place(todo, remainder);
-                todo = remainder;
+                canvas.Place(*input, remainder);
+                todo.swap(remainder);
+                input = &todo;
             }
 
+            if(input == &contentVector)
+                remainder = contentVector;
+            else
+                remainder.swap(todo);
+
             if(remainder.size()==0)
                 return true;
 
@@ -306,11 +330,14 @@ namespace BinPack2D {
         const int h;
 
         Canvas(int w, int h)
-        : needToSort(false),
+        : frontOrder(0),
+        backOrder(0),
+        gridW(0),
+        gridH(0),
         w(w),
         h(h)
         {
-            topLefts.push_back( Coord(0,0) );
+            PushBack( Coord(0,0) );
         }
 
         bool HasContent() const {
@@ -349,11 +376,9 @@ namespace BinPack2D {
 
         bool Place(Content<_T> content) {
 
-            Sort();
+            for( typename std::set<TopLeft>::iterator itor = topLefts.begin(); itor != topLefts.end(); itor++ ) {
 
-            for( Coord::List::iterator itor = topLefts.begin(); itor != topLefts.end(); itor++ ) {
-
-                content.coord = *itor;
+                content.coord = itor->coord;
 
                 if( Fits( content ) ) {
 
@@ -367,9 +392,9 @@ namespace BinPack2D {
 
             // EXPERIMENTAL - TRY ROTATED?
             if (content.Rotate()) {
-                for( Coord::List::iterator itor = topLefts.begin(); itor != topLefts.end(); itor++ ) {
+                for( typename std::set<TopLeft>::iterator itor = topLefts.begin(); itor != topLefts.end(); itor++ ) {
 
-                    content.coord = *itor;
+                    content.coord = itor->coord;
 
                     if( Fits( content ) ) {
 
@@ -395,9 +420,21 @@ namespace BinPack2D {
             if( (content.coord.y + content.size.h) > h )
                 return false;
 
-            for( typename Content<_T>::Vector::const_iterator itor = contentVector.begin(); itor != contentVector.end(); itor++ )
-                if( content.intersects( *itor ) )
-                    return false;
+            if( grid.empty() )
+                return true;
+
+            int left, top, right, bottom;
+            CellRange( content, left, top, right, bottom );
+
+            for( int y = top; y <= bottom; y++ )
+                for( int x = left; x <= right; x++ ) {
+
+                    const std::vector<int> &cell = grid[ y * gridW + x ];
+
+                    for( std::vector<int>::const_iterator itor = cell.begin(); itor != cell.end(); itor++ )
+                        if( content.intersects( contentVector[ *itor ] ) )
+                            return false;
+                }
 
             return true;
         }
@@ -407,42 +444,52 @@ namespace BinPack2D {
             const Size  &size = content.size;
             const Coord &coord = content.coord;
 
-            topLefts.push_front	( Coord( coord.x + size.w, coord.y          ) );
-            topLefts.push_back	( Coord( coord.x         , coord.y + size.h ) );
+            PushFront( Coord( coord.x + size.w, coord.y          ) );
+            PushBack ( Coord( coord.x         , coord.y + size.h ) );
 
-            contentVector.push_back( content );
+            if( grid.empty() ) {
 
-            needToSort = true;
-
-            return true;
-        }
+                gridW = std::max( (w + CellSize - 1) / CellSize, 1 );
+                gridH = std::max( (h + CellSize - 1) / CellSize, 1 );
+                grid.resize( gridW * gridH );
+            }
 
-    private:
+            int left, top, right, bottom;
+            CellRange( content, left, top, right, bottom );
 
-        struct TopToBottomLeftToRightSort {
+            for( int y = top; y <= bottom; y++ )
+                for( int x = left; x <= right; x++ )
+                    grid[ y * gridW + x ].push_back( (int)contentVector.size() );
 
-            bool operator()(const Coord &a, const Coord &b) const {
+            contentVector.push_back( content );
 
-                return sqrtf( a.x * a.x + a.y * a.y ) < sqrtf( b.x * b.x + b.y * b.y );
+            return true;
+        }
 
+        // grid cells covered by the content, empty content still takes the cell of its coord
+        void CellRange( const Content<_T> &content, int &left, int &top, int &right, int &bottom ) const {
 
-                if(a.y != b.y)
-                    return a.y < b.y;
+            left   = std::min( content.coord.x / CellSize, gridW - 1 );
+            top    = std::min( content.coord.y / CellSize, gridH - 1 );
+            right  = std::min( (content.coord.x + std::max( content.size.w, 1 ) - 1) / CellSize, gridW - 1 );
+            bottom = std::min( (content.coord.y + std::max( content.size.h, 1 ) - 1) / CellSize, gridH - 1 );
+        }
 
-                return a.x < b.x;
-            }
-        };
+        static float Distance( const Coord &coord ) {
 
-    public:
+            return sqrtf( coord.x * coord.x + coord.y * coord.y );
+        }
 
-        void Sort() {
+        void PushFront( const Coord &coord ) {
 
-            if(!needToSort)
-                return;
+            TopLeft topLeft = { Distance( coord ), --frontOrder, coord };
+            topLefts.insert( topLeft );
+        }
 
-            topLefts.sort(TopToBottomLeftToRightSort());
+        void PushBack( const Coord &coord ) {
 
-            needToSort = false;
+            TopLeft topLeft = { Distance( coord ), backOrder++, coord };
+            topLefts.insert( topLeft );
         }
     };
 
@@ -548,6 +595,11 @@ namespace BinPack2D {
 
             std::sort( contentVector.begin(), contentVector.end(), GreatestWidthThenGreatestHeightSort() );
         }
+
+        template<typename _Compare> void Sort( _Compare compare ) {
+
+            std::sort( contentVector.begin(), contentVector.end(), compare );
+        }
     };
 
     template <typename _T> class UniformCanvasArrayBuilder {
@@ -580,6 +632,10 @@ namespace BinPack2D {
         : canvasArray( canvasArray )
         {}
 
+        CanvasArray( typename Canvas<_T>::Vector &&canvasArray )
+        : canvasArray( std::move(canvasArray) )
+        {}
+
         bool Place(const typename Content<_T>::Vector &contentVector, typename Content<_T>::Vector &remainder) {
 
             return Canvas<_T>::Place( canvasArray, contentVector, remainder );
@@ -604,6 +660,11 @@ namespace BinPack2D {
 
             int z = 0;
 
+            size_t count = contentVector.size();
+            for( typename Canvas<_T>::Vector::const_iterator itor = canvasArray.begin(); itor != canvasArray.end(); itor++ )
+                count += itor->GetContents().size();
+            contentVector.reserve(count);
+
             for( typename Canvas<_T>::Vector::const_iterator itor = canvasArray.begin(); itor != canvasArray.end(); itor++ ) {
 
                 const typename Content<_T>::Vector &contents = itor->GetContents();
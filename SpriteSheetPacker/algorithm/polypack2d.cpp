@@ -1,5 +1,6 @@
 #include "polypack2d.h"
 #include "triangle_triangle_intersection.h"
+#include <algorithm>
 
 namespace PolyPack2D {
     bool rectIntersect(const Rect& r1, const Rect& r2) {
@@ -27,4 +28,156 @@ namespace PolyPack2D {
         }
         return false;
     }
+
+    static const float kGridCellSize = 32.f;
+    static const float kBitmapCellSize = 4.f;
+    // distance from the triangle edges to the occupied cells and the centers
+    static const double kInnerMargin = 0.5;
+    // placed triangles closer than this are always tested
+    static const float kBoundsMargin = 1.f;
+
+    bool hasInnerCenter(const Point& a, const Point& b, const Point& c) {
+        double area2 = fabs(((double)b.x - a.x) * ((double)c.y - a.y) - ((double)b.y - a.y) * ((double)c.x - a.x));
+        double ab = hypot((double)b.x - a.x, (double)b.y - a.y);
+        double bc = hypot((double)c.x - b.x, (double)c.y - b.y);
+        double ca = hypot((double)a.x - c.x, (double)a.y - c.y);
+        double maxEdge = std::max(ab, std::max(bc, ca));
+        // distance from the center to the edge is area2 / (3 * edge)
+        return (maxEdge > 0) && (area2 >= 3 * maxEdge * kInnerMargin);
+    }
+
+    TriangleIndex::TriangleIndex(int sizeLimit) {
+        _gridSize = sizeLimit / kGridCellSize + 2;
+        _grid.resize(_gridSize * _gridSize);
+        _bitmapSize = sizeLimit / kBitmapCellSize + 2;
+        _bitmap.assign(_bitmapSize * _bitmapSize, 0);
+    }
+
+    int TriangleIndex::cellIndex(float value, float cellSize, int count) const {
+        int index = (int)floorf(value / cellSize);
+        return std::min(std::max(index, 0), count - 1);
+    }
+
+    void TriangleIndex::insert(const Triangles& triangles, const Rect& bounds) {
+        int owner = _ownerBounds.size();
+        _ownerBounds.push_back(bounds);
+
+        for (size_t i = 0; i < triangles.indices.size(); i += 3) {
+            IndexedTriangle triangle;
+            triangle.owner = owner;
+            for (int v = 0; v < 3; ++v) {
+                const Point& point = triangles.verts[triangles.indices[i + v]];
+                triangle.verts[v][0] = point.x;
+                triangle.verts[v][1] = point.y;
+            }
+            triangle.bounds.left = std::min(triangle.verts[0][0], std::min(triangle.verts[1][0], triangle.verts[2][0]));
+            triangle.bounds.right = std::max(triangle.verts[0][0], std::max(triangle.verts[1][0], triangle.verts[2][0]));
+            triangle.bounds.top = std::min(triangle.verts[0][1], std::min(triangle.verts[1][1], triangle.verts[2][1]));
+            triangle.bounds.bottom = std::max(triangle.verts[0][1], std::max(triangle.verts[1][1], triangle.verts[2][1]));
+
+            // grid
+            triangle.cellX = cellIndex(triangle.bounds.left - kBoundsMargin, kGridCellSize, _gridSize);
+            triangle.cellY = cellIndex(triangle.bounds.top - kBoundsMargin, kGridCellSize, _gridSize);
+            int cellRight = cellIndex(triangle.bounds.right + kBoundsMargin, kGridCellSize, _gridSize);
+            int cellBottom = cellIndex(triangle.bounds.bottom + kBoundsMargin, kGridCellSize, _gridSize);
+            int triangleIndex = _triangles.size();
+            for (int y = triangle.cellY; y <= cellBottom; ++y) {
+                for (int x = triangle.cellX; x <= cellRight; ++x) {
+                    _grid[y * _gridSize + x].push_back(triangleIndex);
+                }
+            }
+            _triangles.push_back(triangle);
+
+            // occupancy bitmap: cells with all corners inside the triangle
+            double edges[3][3]; // normalized edge lines: a*x + b*y + c >= 0 inside
+            double orientation = ((double)triangle.verts[1][0] - triangle.verts[0][0]) * ((double)triangle.verts[2][1] - triangle.verts[0][1])
+                    - ((double)triangle.verts[1][1] - triangle.verts[0][1]) * ((double)triangle.verts[2][0] - triangle.verts[0][0]);
+            if (orientation == 0) continue;
+            bool degenerate = false;
+            for (int e = 0; e < 3; ++e) {
+                const float* p1 = triangle.verts[e];
+                const float* p2 = triangle.verts[(e + 1) % 3];
+                double dx = (double)p2[0] - p1[0];
+                double dy = (double)p2[1] - p1[1];
+                double len = hypot(dx, dy);
+                if (len == 0) {
+                    degenerate = true;
+                    break;
+                }
+                double sign = (orientation > 0)? 1 : -1;
+                edges[e][0] = -dy * sign / len;
+                edges[e][1] = dx * sign / len;
+                edges[e][2] = -(edges[e][0] * p1[0] + edges[e][1] * p1[1]);
+            }
+            if (degenerate) continue;
+
+            int left = std::max((int)ceilf(triangle.bounds.left / kBitmapCellSize), 0);
+            int top = std::max((int)ceilf(triangle.bounds.top / kBitmapCellSize), 0);
+            int right = std::min((int)floorf(triangle.bounds.right / kBitmapCellSize), _bitmapSize);
+            int bottom = std::min((int)floorf(triangle.bounds.bottom / kBitmapCellSize), _bitmapSize);
+            for (int y = top; y < bottom; ++y) {
+                for (int x = left; x < right; ++x) {
+                    bool inside = true;
+                    for (int corner = 0; (corner < 4) && inside; ++corner) {
+                        double px = (x + (corner & 1)) * kBitmapCellSize;
+                        double py = (y + (corner >> 1)) * kBitmapCellSize;
+                        for (int e = 0; e < 3; ++e) {
+                            if (edges[e][0] * px + edges[e][1] * py + edges[e][2] < kInnerMargin) {
+                                inside = false;
+                                break;
+                            }
+                        }
+                    }
+                    if (inside) _bitmap[y * _bitmapSize + x] = 1;
+                }
+            }
+        }
+    }
+
+    bool TriangleIndex::isOccupied(const Point& p) const {
+        int x = (int)floorf(p.x / kBitmapCellSize);
+        int y = (int)floorf(p.y / kBitmapCellSize);
+        if ((x < 0) || (y < 0) || (x >= _bitmapSize) || (y >= _bitmapSize)) return false;
+        return _bitmap[y * _bitmapSize + x] != 0;
+    }
+
+    bool TriangleIndex::intersects(const Point& a, const Point& b, const Point& c, const Rect& rect) const {
+        Rect bounds;
+        bounds.left = std::min(a.x, std::min(b.x, c.x));
+        bounds.right = std::max(a.x, std::max(b.x, c.x));
+        bounds.top = std::min(a.y, std::min(b.y, c.y));
+        bounds.bottom = std::max(a.y, std::max(b.y, c.y));
+
+        int cellLeft = cellIndex(bounds.left - kBoundsMargin, kGridCellSize, _gridSize);
+        int cellTop = cellIndex(bounds.top - kBoundsMargin, kGridCellSize, _gridSize);
+        int cellRight = cellIndex(bounds.right + kBoundsMargin, kGridCellSize, _gridSize);
+        int cellBottom = cellIndex(bounds.bottom + kBoundsMargin, kGridCellSize, _gridSize);
+
+        float a1[2] = { a.x, a.y };
+        float a2[2] = { b.x, b.y };
+        float a3[2] = { c.x, c.y };
+        for (int y = cellTop; y <= cellBottom; ++y) {
+            for (int x = cellLeft; x <= cellRight; ++x) {
+                for (int triangleIndex: _grid[y * _gridSize + x]) {
+                    const IndexedTriangle& triangle = _triangles[triangleIndex];
+                    // test every triangle once, in the first common cell
+                    if ((std::max(cellLeft, triangle.cellX) != x) || (std::max(cellTop, triangle.cellY) != y)) continue;
+
+                    if ((triangle.bounds.left > bounds.right + kBoundsMargin) ||
+                        (triangle.bounds.right < bounds.left - kBoundsMargin) ||
+                        (triangle.bounds.top > bounds.bottom + kBoundsMargin) ||
+                        (triangle.bounds.bottom < bounds.top - kBoundsMargin)) continue;
+                    if (!rectIntersect(rect, _ownerBounds[triangle.owner])) continue;
+
+                    float b1[2] = { triangle.verts[0][0], triangle.verts[0][1] };
+                    float b2[2] = { triangle.verts[1][0], triangle.verts[1][1] };
+                    float b3[2] = { triangle.verts[2][0], triangle.verts[2][1] };
+                    if (tri_tri_overlap_test_2d(a1, a2, a3, b1, b2, b3)) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
 }
@@ -25,8 +25,10 @@
 
 #include <QPointF>
 #include <QDebug>
+#include <QtConcurrent>
 #include <math.h>
 #include <functional>
+#include <atomic>
 
 namespace PolyPack2D {
 
@@ -100,6 +102,39 @@ namespace PolyPack2D {
 
     bool rectIntersect(const Rect& r1, const Rect& r2);
     bool trianglesIntersect(const Triangles& a, const Triangles& b);
+    // triangle is wide enough around the center to be used for the early rejection
+    bool hasInnerCenter(const Point& a, const Point& b, const Point& c);
+
+    // Spatial index of the placed triangles: uniform grid for the triangle tests
+    // and occupancy bitmap of cells lying completely inside the placed triangles.
+    class TriangleIndex {
+    public:
+        TriangleIndex(int sizeLimit = 8192);
+
+        void insert(const Triangles& triangles, const Rect& bounds);
+
+        // point is inside a placed triangle (early rejection)
+        bool isOccupied(const Point& p) const;
+        // triangle intersects a placed triangle of content with bounds intersecting the rect
+        bool intersects(const Point& a, const Point& b, const Point& c, const Rect& rect) const;
+
+    protected:
+        struct IndexedTriangle {
+            float verts[3][2];
+            Rect bounds;
+            int owner;
+            int cellX, cellY;
+        };
+
+        int cellIndex(float value, float cellSize, int count) const;
+
+        int _gridSize;
+        std::vector<std::vector<int>> _grid;
+        int _bitmapSize;
+        std::vector<unsigned char> _bitmap;
+        std::vector<IndexedTriangle> _triangles;
+        std::vector<Rect> _ownerBounds;
+    };
     /////
 
 
@@ -208,7 +243,14 @@ namespace PolyPack2D {
 
     template <class T> class Container: public std::vector<Content<T>> {
     public:
-        void place(const ContentList<T>& inputContent, int sizeLimit = 8192, int step = 5, std::function<void (int, int)> callback = NULL) {
+        // Place content by scanning positions with the step. When refineCount > 0 the best refineCount
+        // positions of the scan are refined with 1px step around them.
+        void place(const ContentList<T>& inputContent, int sizeLimit = 8192, int step = 5, int refineCount = 0, std::function<void (int, int)> callback = NULL, std::function<bool ()> abortCallback = NULL) {
+            TriangleIndex index(sizeLimit);
+            for (auto& placed: _contentList) {
+                index.insert(placed.triangles(), placed.bounds());
+            }
+
             int contentIndex = 0;
             for (auto it = inputContent.begin(); it != inputContent.end(); ++it, ++contentIndex) {
                 auto content = (*it);
@@ -216,69 +258,155 @@ namespace PolyPack2D {
                 if (it == inputContent.begin()) {
                     _bounds = content.bounds();
                     _contentList.push_back(content);
+                    index.insert(content.triangles(), content.bounds());
                 } else {
                     float startX = 0;//_bounds.left - (content.bounds().right - content.bounds().left) - step;
                     float startY = 0;//_bounds.top - (content.bounds().bottom - content.bounds().top) - step;
                     float endX = _bounds.right + step + (content.bounds().right - content.bounds().left);
                     float endY = _bounds.bottom + step + (content.bounds().bottom - content.bounds().top);
 
-                    bool isPlaces = false;
-                    float bestArea = 0;
-                    Point bestOffset;
+                    // centers of the triangles for the early rejection
+                    const Triangles& triangles = content.triangles();
+                    std::vector<Point> centers;
+                    for (size_t i = 0; i < triangles.indices.size(); i += 3) {
+                        const Point& a = triangles.verts[triangles.indices[i + 0]];
+                        const Point& b = triangles.verts[triangles.indices[i + 1]];
+                        const Point& c = triangles.verts[triangles.indices[i + 2]];
+                        if (hasInnerCenter(a, b, c)) {
+                            centers.push_back(Point((a.x + b.x + c.x) / 3.f, (a.y + b.y + c.y) / 3.f));
+                        }
+                    }
 
-                    bool translateTriangles = false;
-                    Triangles contentTriangles;
+                    // content at the position doesn't exceed the size limit and intersect the placed content
+                    auto isFree = [&](float x, float y, const Rect& contentBounds, const Rect& newBounds) -> bool {
+//                        if (newBounds.width() > (newBounds.height()*2)) return false;
+//                        if (newBounds.height() > (newBounds.width()*2)) return false;
+                        if (newBounds.width() > sizeLimit) return false;
+                        if (newBounds.height() > sizeLimit) return false;
 
+                        for (auto& center: centers) {
+                            if (index.isOccupied(Point(center.x + x, center.y + y))) return false;
+                        }
+                        for (size_t i = 0; i < triangles.indices.size(); i += 3) {
+                            const Point& a = triangles.verts[triangles.indices[i + 0]];
+                            const Point& b = triangles.verts[triangles.indices[i + 1]];
+                            const Point& c = triangles.verts[triangles.indices[i + 2]];
+                            if (index.intersects(Point(a.x + x, a.y + y), Point(b.x + x, b.y + y), Point(c.x + x, c.y + y), contentBounds)) return false;
+                        }
+                        return true;
+                    };
+                    auto contentBoundsAt = [&](float x, float y) -> Rect {
+                        auto contentBounds = content.bounds();
+                        contentBounds.left += x;
+                        contentBounds.right += x;
+                        contentBounds.top += y;
+                        contentBounds.bottom += y;
+                        return contentBounds;
+                    };
+
+                    // Coarse search with the step. Rows are split into chunks, each chunk keeps its first
+                    // positions with the smallest area, the earliest chunk wins on equal area like in the serial scan.
+                    size_t candidateCount = (refineCount > 0) && (step > 1)? refineCount : 1;
+                    std::vector<float> rows;
                     for (float y = startY; y < endY; y+= step) {
-                        for (float x = startX; x < endX; x+= step) {
-                            auto contentBounds = content.bounds();
-                            contentBounds.left += x;
-                            contentBounds.right += x;
-                            contentBounds.top += y;
-                            contentBounds.bottom += y;
-
-                            auto newBounds(_bounds + contentBounds);
-                            float area = newBounds.area();
-                            if ((area > bestArea) && (isPlaces)) {
-                                continue;
+                        rows.push_back(y);
+                    }
+                    int chunkSize = std::max<int>(1, rows.size() / (QThread::idealThreadCount() * 4));
+                    std::vector<int> chunks;
+                    for (size_t row = 0; row < rows.size(); row += chunkSize) {
+                        chunks.push_back(chunks.size());
+                    }
+                    std::vector<std::vector<SearchResult>> results(chunks.size());
+                    // smallest area found by any chunk, positions above it can't win
+                    std::atomic<float> sharedArea(std::numeric_limits<float>::max());
+
+                    std::function<void (int)> searchChunk = [&](int chunk) {
+                        std::vector<SearchResult>& best = results[chunk];
+                        size_t lastRow = std::min(rows.size(), (size_t)(chunk + 1) * chunkSize);
+                        for (size_t row = chunk * chunkSize; row < lastRow; ++row) {
+                            if (abortCallback && abortCallback()) return;
+
+                            float y = rows[row];
+                            for (float x = startX; x < endX; x+= step) {
+                                auto contentBounds = contentBoundsAt(x, y);
+                                auto newBounds(_bounds + contentBounds);
+                                float area = newBounds.area();
+                                if ((best.size() == candidateCount) && (area > best.back().area)) {
+                                    continue;
+                                }
+                                if ((candidateCount == 1) && (area > sharedArea.load(std::memory_order_relaxed))) {
+                                    continue;
+                                }
+                                if (!isFree(x, y, contentBounds, newBounds)) {
+                                    continue;
+                                }
+
+                                SearchResult result;
+                                result.isPlaces = true;
+                                result.area = area;
+                                result.offset = Point(x, y);
+                                insertResult(best, result, candidateCount);
+
+                                float shared = sharedArea.load();
+                                while ((area < shared) && !sharedArea.compare_exchange_weak(shared, area));
                             }
-//                            if (newBounds.width() > (newBounds.height()*2)) continue;
-//                            if (newBounds.height() > (newBounds.width()*2)) continue;
-                            if (newBounds.width() > sizeLimit) continue;
-                            if (newBounds.height() > sizeLimit) continue;
-
-                            translateTriangles = false;
-
-                            // test intersect intersection
-                            bool intersect = false;
-                            for (auto in_it = _contentList.begin(); in_it != _contentList.end(); ++in_it) {
-                                if (rectIntersect(contentBounds, (*in_it).bounds())) {
-                                    // translate triangles and test intersection
-                                    if (!translateTriangles) {
-                                        contentTriangles = content.triangles();
-                                        for (auto it_p = contentTriangles.verts.begin(); it_p != contentTriangles.verts.end(); ++it_p) {
-                                            (*it_p).x += x;
-                                            (*it_p).y += y;
-                                        }
-                                        translateTriangles = true;
+                        }
+                    };
+                    QtConcurrent::blockingMap(chunks, searchChunk);
+                    if (abortCallback && abortCallback()) return;
+
+                    std::vector<SearchResult> candidates;
+                    for (auto& chunkResults: results) {
+                        for (auto& result: chunkResults) {
+                            insertResult(candidates, result, candidateCount);
+                        }
+                    }
+
+                    // refine around the best coarse positions with 1px step
+                    if ((candidateCount > 1) && !candidates.empty()) {
+                        std::vector<SearchResult> refined(candidates.size());
+                        std::vector<int> refineIndices;
+                        for (size_t i = 0; i < candidates.size(); ++i) {
+                            refineIndices.push_back(i);
+                        }
+                        std::function<void (int)> refineCandidate = [&](int candidate) {
+                            SearchResult& result = refined[candidate];
+                            result = candidates[candidate];
+                            const Point& center = candidates[candidate].offset;
+                            for (int dy = 1 - step; dy < step; ++dy) {
+                                if (abortCallback && abortCallback()) return;
+
+                                float y = center.y + dy;
+                                if ((y < startY) || (y >= endY)) continue;
+                                for (int dx = 1 - step; dx < step; ++dx) {
+                                    float x = center.x + dx;
+                                    if ((x < startX) || (x >= endX)) continue;
+
+                                    auto contentBounds = contentBoundsAt(x, y);
+                                    auto newBounds(_bounds + contentBounds);
+                                    float area = newBounds.area();
+                                    if (area >= result.area) {
+                                        continue;
                                     }
-                                    if (trianglesIntersect(contentTriangles, (*in_it).triangles())) {
-                                        intersect = true;
-                                        break;
+                                    if (isFree(x, y, contentBounds, newBounds)) {
+                                        result.area = area;
+                                        result.offset = Point(x, y);
                                     }
                                 }
                             }
+                        };
+                        QtConcurrent::blockingMap(refineIndices, refineCandidate);
+                        if (abortCallback && abortCallback()) return;
 
-                            if (!intersect) {
-                                if ((!isPlaces) || (area < bestArea)) {
-                                    bestArea = area;
-                                    bestOffset = Point(x, y);
-                                    isPlaces = true;
-                                }
-                            }
+                        candidates.clear();
+                        for (auto& result: refined) {
+                            insertResult(candidates, result, 1);
                         }
                     }
 
+                    bool isPlaces = !candidates.empty();
+                    Point bestOffset = isPlaces? candidates.front().offset : Point();
+
                     if (isPlaces) {
                         qDebug() << "Placing: " << contentIndex << "/" << inputContent.size();
                         if (callback)
@@ -290,6 +418,7 @@ namespace PolyPack2D {
                         if (_bounds.top > content.bounds().top) _bounds.top = content.bounds().top;
                         if (_bounds.bottom < content.bounds().bottom) _bounds.bottom = content.bounds().bottom;
                         _contentList.push_back(content);
+                        index.insert(content.triangles(), content.bounds());
                     } else {
                         qDebug() << "Not placed";
                     }
@@ -301,6 +430,24 @@ namespace PolyPack2D {
         const ContentList<T>& contentList() const { return _contentList; }
 
     protected:
+        struct SearchResult {
+            bool isPlaces;
+            float area;
+            Point offset;
+
+            SearchResult(): isPlaces(false), area(0) { }
+        };
+
+        // keep up to count results sorted by area, on equal area the earlier result goes first
+        static void insertResult(std::vector<SearchResult>& results, const SearchResult& result, size_t count) {
+            auto it = std::upper_bound(results.begin(), results.end(), result, [](const SearchResult& a, const SearchResult& b) {
+                return a.area < b.area;
+            });
+            if ((size_t)(it - results.begin()) >= count) return;
+            results.insert(it, result);
+            if (results.size() > count) results.pop_back();
+        }
+
         Rect _bounds;
         ContentList<T> _contentList;
     };
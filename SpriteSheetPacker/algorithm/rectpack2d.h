@@ -0,0 +1,354 @@
+/*
+ Copyright (c) 2016, amakaseev < aleksey.makaseev.@gmail.com >
+ All rights reserved.
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 1. Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * RectPack2D - free rectangle (MaxRects) and skyline bin packers.
+ * Both place one rectangle at a time (input is expected to be sorted, like BinPack2D),
+ * but instead of testing every placed rectangle for collision they only look at the free space:
+ * MaxRects keeps the list of maximal free rectangles, Skyline keeps the top edge of the packed area.
+ * CanvasArray adapts a bin to the BinPack2D content/accumulator interface.
+ */
+
+#ifndef RECTPACK2D_H
+#define RECTPACK2D_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "binpack2d.hpp"
+
+namespace RectPack2D {
+
+    struct Rect {
+        int x, y, w, h;
+
+        Rect(): x(0), y(0), w(0), h(0) { }
+        Rect(int _x, int _y, int _w, int _h): x(_x), y(_y), w(_w), h(_h) { }
+
+        int right() const { return x + w; }
+        int bottom() const { return y + h; }
+
+        bool contains(const Rect& r) const {
+            return (r.x >= x) && (r.y >= y) && (r.right() <= right()) && (r.bottom() <= bottom());
+        }
+        bool intersects(const Rect& r) const {
+            return (r.x < right()) && (r.right() > x) && (r.y < bottom()) && (r.bottom() > y);
+        }
+    };
+
+    enum MaxRectsHeuristic {
+        BestShortSideFit,   // BSSF: smallest leftover on the short side of the free rect
+        BestAreaFit,        // BAF: smallest free rect that fits
+        BottomLeft,         // BL: lowest top edge, then leftmost (Tetris)
+        ContactPoint        // CP: longest edge contact with the bin border and placed rects
+    };
+
+    class MaxRectsBin {
+    public:
+        MaxRectsBin(int width, int height, MaxRectsHeuristic heuristic = BestShortSideFit)
+            : _width(width)
+            , _height(height)
+            , _heuristic(heuristic)
+        {
+            if ((width > 0) && (height > 0)) {
+                _freeRects.push_back(Rect(0, 0, width, height));
+            }
+        }
+
+        bool insert(int width, int height, bool allowRotate, Rect& result, bool& rotated) {
+            int bestScore1 = std::numeric_limits<int>::max();
+            int bestScore2 = std::numeric_limits<int>::max();
+            bool found = false;
+
+            for (const Rect& freeRect: _freeRects) {
+                for (int r = 0; r < (allowRotate? 2 : 1); ++r) {
+                    int w = r? height : width;
+                    int h = r? width : height;
+                    if ((w > freeRect.w) || (h > freeRect.h)) continue;
+
+                    int score1 = 0, score2 = 0;
+                    Rect rect(freeRect.x, freeRect.y, w, h);
+                    score(freeRect, rect, score1, score2);
+                    if ((score1 < bestScore1) || ((score1 == bestScore1) && (score2 < bestScore2))) {
+                        bestScore1 = score1;
+                        bestScore2 = score2;
+                        result = rect;
+                        rotated = (r != 0);
+                        found = true;
+                    }
+                }
+            }
+
+            if (found) {
+                occupy(result);
+            }
+            return found;
+        }
+
+        // mark rect as used, splitting every free rect it overlaps
+        void occupy(const Rect& used) {
+            std::vector<Rect> newRects;
+            for (size_t i = 0; i < _freeRects.size();) {
+                if (split(_freeRects[i], used, newRects)) {
+                    _freeRects[i] = _freeRects.back();
+                    _freeRects.pop_back();
+                } else {
+                    ++i;
+                }
+            }
+            _freeRects.insert(_freeRects.end(), newRects.begin(), newRects.end());
+            prune();
+            _usedRects.push_back(used);
+        }
+
+        const std::vector<Rect>& freeRects() const { return _freeRects; }
+        const std::vector<Rect>& usedRects() const { return _usedRects; }
+
+    protected:
+        void score(const Rect& freeRect, const Rect& rect, int& score1, int& score2) const {
+            int leftoverHoriz = freeRect.w - rect.w;
+            int leftoverVert = freeRect.h - rect.h;
+            int shortSide = std::min(leftoverHoriz, leftoverVert);
+            int longSide = std::max(leftoverHoriz, leftoverVert);
+            switch (_heuristic) {
+                case BestShortSideFit:
+                    score1 = shortSide;
+                    score2 = longSide;
+                    break;
+                case BestAreaFit:
+                    score1 = freeRect.w * freeRect.h - rect.w * rect.h;
+                    score2 = shortSide;
+                    break;
+                case BottomLeft:
+                    score1 = rect.bottom();
+                    score2 = rect.x;
+                    break;
+                case ContactPoint:
+                    score1 = -contactScore(rect);
+                    score2 = shortSide;
+                    break;
+            }
+        }
+
+        static int commonInterval(int a1, int a2, int b1, int b2) {
+            if ((a2 < b1) || (b2 < a1)) return 0;
+            return std::min(a2, b2) - std::max(a1, b1);
+        }
+
+        int contactScore(const Rect& rect) const {
+            int score = 0;
+            if ((rect.x == 0) || (rect.right() == _width)) score += rect.h;
+            if ((rect.y == 0) || (rect.bottom() == _height)) score += rect.w;
+
+            for (const Rect& used: _usedRects) {
+                if ((used.x == rect.right()) || (used.right() == rect.x)) {
+                    score += commonInterval(used.y, used.bottom(), rect.y, rect.bottom());
+                }
+                if ((used.y == rect.bottom()) || (used.bottom() == rect.y)) {
+                    score += commonInterval(used.x, used.right(), rect.x, rect.right());
+                }
+            }
+            return score;
+        }
+
+        static bool split(const Rect& freeRect, const Rect& used, std::vector<Rect>& newRects) {
+            if (!freeRect.intersects(used)) return false;
+
+            if ((used.x < freeRect.right()) && (used.right() > freeRect.x)) {
+                // top part
+                if ((used.y > freeRect.y) && (used.y < freeRect.bottom())) {
+                    newRects.push_back(Rect(freeRect.x, freeRect.y, freeRect.w, used.y - freeRect.y));
+                }
+                // bottom part
+                if (used.bottom() < freeRect.bottom()) {
+                    newRects.push_back(Rect(freeRect.x, used.bottom(), freeRect.w, freeRect.bottom() - used.bottom()));
+                }
+            }
+            if ((used.y < freeRect.bottom()) && (used.bottom() > freeRect.y)) {
+                // left part
+                if ((used.x > freeRect.x) && (used.x < freeRect.right())) {
+                    newRects.push_back(Rect(freeRect.x, freeRect.y, used.x - freeRect.x, freeRect.h));
+                }
+                // right part
+                if (used.right() < freeRect.right()) {
+                    newRects.push_back(Rect(used.right(), freeRect.y, freeRect.right() - used.right(), freeRect.h));
+                }
+            }
+            return true;
+        }
+
+        // remove free rects contained in other free rects
+        void prune() {
+            for (size_t i = 0; i < _freeRects.size(); ++i) {
+                for (size_t j = i + 1; j < _freeRects.size();) {
+                    if (_freeRects[i].contains(_freeRects[j])) {
+                        _freeRects.erase(_freeRects.begin() + j);
+                    } else if (_freeRects[j].contains(_freeRects[i])) {
+                        _freeRects.erase(_freeRects.begin() + i);
+                        --i;
+                        break;
+                    } else {
+                        ++j;
+                    }
+                }
+            }
+        }
+
+    protected:
+        int _width;
+        int _height;
+        MaxRectsHeuristic _heuristic;
+        std::vector<Rect> _freeRects;
+        std::vector<Rect> _usedRects;
+    };
+
+    class SkylineBin {
+    public:
+        SkylineBin(int width, int height)
+            : _width(width)
+            , _height(height)
+        {
+            if ((width > 0) && (height > 0)) {
+                _skyline.push_back(Segment(0, 0, width));
+            }
+        }
+
+        // bottom-left rule: lowest top edge, then the narrowest segment
+        bool insert(int width, int height, bool allowRotate, Rect& result, bool& rotated) {
+            int bestHeight = std::numeric_limits<int>::max();
+            int bestWidth = std::numeric_limits<int>::max();
+            int bestIndex = -1;
+
+            for (size_t i = 0; i < _skyline.size(); ++i) {
+                for (int r = 0; r < (allowRotate? 2 : 1); ++r) {
+                    int w = r? height : width;
+                    int h = r? width : height;
+                    int y;
+                    if (!fits(i, w, h, y)) continue;
+
+                    if ((y + h < bestHeight) || ((y + h == bestHeight) && (_skyline[i].w < bestWidth))) {
+                        bestHeight = y + h;
+                        bestWidth = _skyline[i].w;
+                        bestIndex = i;
+                        result = Rect(_skyline[i].x, y, w, h);
+                        rotated = (r != 0);
+                    }
+                }
+            }
+
+            if (bestIndex == -1) return false;
+
+            addLevel(bestIndex, result);
+            return true;
+        }
+
+    protected:
+        struct Segment {
+            int x, y, w;
+            Segment(int _x, int _y, int _w): x(_x), y(_y), w(_w) { }
+        };
+
+        bool fits(size_t index, int width, int height, int& y) const {
+            int x = _skyline[index].x;
+            if (x + width > _width) return false;
+
+            int widthLeft = width;
+            y = _skyline[index].y;
+            for (size_t i = index; widthLeft > 0; ++i) {
+                y = std::max(y, _skyline[i].y);
+                if (y + height > _height) return false;
+                widthLeft -= _skyline[i].w;
+            }
+            return true;
+        }
+
+        void addLevel(size_t index, const Rect& rect) {
+            _skyline.insert(_skyline.begin() + index, Segment(rect.x, rect.bottom(), rect.w));
+
+            for (size_t i = index + 1; i < _skyline.size();) {
+                const Segment& prev = _skyline[i - 1];
+                if (_skyline[i].x >= prev.x + prev.w) break;
+
+                int shrink = prev.x + prev.w - _skyline[i].x;
+                _skyline[i].x += shrink;
+                _skyline[i].w -= shrink;
+                if (_skyline[i].w > 0) break;
+                _skyline.erase(_skyline.begin() + i);
+            }
+
+            // merge segments on the same level
+            for (size_t i = 0; i + 1 < _skyline.size();) {
+                if (_skyline[i].y == _skyline[i + 1].y) {
+                    _skyline[i].w += _skyline[i + 1].w;
+                    _skyline.erase(_skyline.begin() + i + 1);
+                } else {
+                    ++i;
+                }
+            }
+        }
+
+    protected:
+        int _width;
+        int _height;
+        std::vector<Segment> _skyline;
+    };
+
+    // single canvas with BinPack2D::CanvasArray like interface
+    template<class Bin, class T> class CanvasArray {
+    public:
+        CanvasArray(const Bin& bin): _bin(bin) { }
+
+        bool Place(const BinPack2D::ContentAccumulator<T>& content, BinPack2D::ContentAccumulator<T>& remainder) {
+            remainder.Get().clear();
+            _placed.reserve(_placed.size() + content.Get().size());
+
+            bool placedAll = true;
+            for (auto it = content.Get().begin(); it != content.Get().end(); ++it) {
+                BinPack2D::Content<T> placed(*it);
+
+                Rect rect;
+                bool rotated = false;
+                if (_bin.insert(placed.size.w, placed.size.h, placed.tryRotate, rect, rotated)) {
+                    if (rotated) placed.Rotate();
+                    placed.coord = BinPack2D::Coord(rect.x, rect.y);
+                    _placed.push_back(placed);
+                } else {
+                    placedAll = false;
+                    remainder += placed;
+                }
+            }
+            return placedAll;
+        }
+
+        bool CollectContent(BinPack2D::ContentAccumulator<T>& content) const {
+            content += _placed;
+            return true;
+        }
+
+    protected:
+        Bin _bin;
+        typename BinPack2D::Content<T>::Vector _placed;
+    };
+
+}
+
+#endif // RECTPACK2D_H
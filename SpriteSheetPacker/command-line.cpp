@@ -2,6 +2,9 @@
 #include "SpriteAtlas.h"
 #include "PublishSpriteSheet.h"
 #include "SpritePackerProjectFile.h"
+#include "PreprocessCache.h"
+#include "SourceImageStore.h"
+#include "LayoutCache.h"
 
 int commandLine(QCoreApplication& app) {
     QCommandLineParser parser;
@@ -16,9 +19,12 @@ int commandLine(QCoreApplication& app) {
         {"trimMode", "Rect - Removes the transparency around a sprite. The sprites appear to have their original size when using them.\n\
 Polygon - The amount of rendered transparency can be reduced by creating a tight fitting polygon around the solid pixels of a sprite. But: The vertices must be transformed by the CPU — introducing new costs.\n\
 Default is Rect", "mode", "Rect"},
-        {"algorithm", "Rect or Polygon. Default is Rect", "mode", "Rect"},
+        {"algorithm", "Rect, MaxRects-BSSF, MaxRects-BAF, MaxRects-BL, MaxRects-CP, Skyline, Best or Polygon. Best packs with every rect algorithm and sort order and keeps the smallest sprite sheet. Default is Rect", "mode", "Rect"},
+        {"search-time", "Time limit in seconds for the Best algorithm search, default is 0 (unlimited).", "float", "0"},
         {"trim", "Allowed values: 1 to 255, default is 1. Pixels with an alpha value below this value will be considered transparent when trimming the sprite. Very useful for sprites with nearly invisible alpha pixels at the borders.", "int", "1"},
         {"epsilon", "Lower values create a tighter fitting mesh with less transparency but with more vertices.\nHigher values on the other hand reduce the number of vertices at the cost of adding more transparency.", "float", "5"},
+        {"polygon-step", "Step in pixels of the coarse polygon placement search, default is 5. With --polygon-candidates 4 a step of 10 packs about as fast and tighter.", "int", "5"},
+        {"polygon-candidates", "Number of the best coarse positions refined with 1 pixel step in polygon placement. 0 disables refinement, default is 0.", "int", "0"},
         {"texture-border", "Border of the sprite sheet, value adds transparent pixels around the borders of the sprite sheet. Default value is 0.", "int", "0"},
         {"sprite-border", "Sprite border is the space between sprites. Value adds transparent pixels between sprites to avoid artifacts from neighbor sprites. The transparent pixels are not added to the sprites, default is 2.", "int", "2"},
         {"powerOf2", "Forces the texture to have power of 2 size (32, 64, 128...). Default is disable."},
@@ -27,10 +33,20 @@ Default is Rect", "mode", "Rect"},
 None - No optimization at all(fastest).\n\
 Lossless - Uses optipng to optimize the filesize. The reduction is mostly small but doesn't harm image quality.\n\
 Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70%, but the image quality gets a bit worse.", "int", "0"},
-        {"png-opt-level", "Optimizes the image's file size. Only useful in combination with opt-mode Lossless. Allowed values: 1 to 7 (Using a high value might take some time to optimize.", "int", "0"},
+        {"png-opt-level", "Optimizes the image's file size. Only useful in combination with opt-mode Lossless or Lossy. Allowed values: 1 to 7 (Using a high value might take some time to optimize.", "int", "0"},
+        {"png-shared-palette", "Lossy png optimization quantizes all the pages of a scaling variant once, to a single palette."},
         {"scale", "Scales all images before creating the sheet. E.g. use 0.5 for half size, default is 1 (Scale has no effect when source is a project file).", "float", "1"},
         {"trimSpriteNames", "Remove image file extensions from the sprite names - e.g. .png, .jpg, ...", "bool", "false"},
         {"prependSmartFolderName", "Prepends the smart folder's name as part of the sprite name.", "bool", "false"},
+        {"no-cache", "Disable the on-disk cache of preprocessed sprites (trim rects, polygons and optionally pixels) shared between builds."},
+        {"stable-layout", "Keep the sprite placement of the previous build and place only new or resized sprites, the atlas is repacked when it gets too fragmented. Needs the layout cache of a project file."},
+        {"no-page-balance", "Fill every page up before the next one when the sprites overflow the max texture size, instead of spreading them evenly."},
+        {"fixed-page-size", "Every page of a multi-page atlas gets the max texture size."},
+        {"no-layout-cache", "Disable the layout cache next to the project file, which reuses the previous layout when the sprite sizes are unchanged."},
+        {"png-trial-threads", "Number of compression trials of the lossless png optimization run in parallel, 0 - one per core.", "int", "0"},
+        {"ccz-level", "zlib compression level of pvr.ccz 0-9, -1 - zlib default.", "int", "-1"},
+        {"variant-threads", "Number of scaling variants generated in parallel, 0 - one per core. More variants at once are faster but need more memory, default is 4.", "int", "4"},
+        {"scale-pyramid", "Scale the smaller scaling variants down from the nearest bigger one instead of the original image. Faster for many variants, the result may differ slightly."},
     });
 
     parser.process(app);
@@ -82,6 +98,8 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
     QString algorithm = "Rect";
     int trim = 1;
     float epsilon = 5.f;
+    int polygonStep = 5;
+    int polygonCandidates = 0;
     int textureBorder = 0;
     int spriteBorder = 2;
     bool pow2 = false;
@@ -92,8 +110,19 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
     QString format = "cocos2d";
     QString pngOptMode = "None";
     int pngOptLevel = 0;
+    bool pngSharedPalette = false;
     bool trimSpriteNames = false;
     bool prependSmartFolderName = false;
+    bool preprocessCache = PreprocessCache::isEnabled();
+    bool scalePyramid = SourceImageStore::usePyramid();
+    bool layoutCache = LayoutCache::isEnabled();
+    bool stableLayout = false;
+    bool balancePages = true;
+    bool fixedPageSize = false;
+    int variantThreads = SpriteAtlas::variantThreads();
+    int pngTrialThreads = OptiPngOptimizer::trialThreads();
+    int cczLevel = PublishSpriteSheet::cczCompressionLevel();
+    float searchTime = 0;
 
     if (projectFile) {
         if (!projectFile->read(source.filePath())) {
@@ -103,12 +132,19 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
             algorithm = projectFile->algorithm();
             trim = projectFile->trimThreshold();
             epsilon = projectFile->epsilon();
+            searchTime = projectFile->searchTime();
+            polygonStep = projectFile->polygonStep();
+            polygonCandidates = projectFile->polygonCandidates();
             textureBorder = projectFile->textureBorder();
             spriteBorder = projectFile->spriteBorder();
             pngOptMode = projectFile->pngOptMode();
             pngOptLevel = projectFile->pngOptLevel();
+            pngSharedPalette = projectFile->pngSharedPalette();
             trimSpriteNames = projectFile->trimSpriteNames();
             prependSmartFolderName = projectFile->prependSmartFolderName();
+            stableLayout = projectFile->stableLayout();
+            balancePages = projectFile->balancePages();
+            fixedPageSize = projectFile->fixedPageSize();
 
             if (!destinationSet) {
                 destination.setFile(projectFile->destPath());
@@ -130,7 +166,12 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
         trimMode = parser.value("trimMode");
     }
     if (parser.isSet("algorithm")) {
-     algorithm = parser.value("algorithm");
+        algorithm = parser.value("algorithm");
+        QStringList algorithms = { "Rect", "MaxRects-BSSF", "MaxRects-BAF", "MaxRects-BL", "MaxRects-CP", "Skyline", "Best", "Polygon" };
+        if (!algorithms.contains(algorithm)) {
+            qCritical() << "Incorrect algorithm:" << algorithm << "must be one of" << algorithms;
+            return -1;
+        }
     }
     if (parser.isSet("trim")) {
         trim = parser.value("trim").toInt();
@@ -138,6 +179,12 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
     if (parser.isSet("epsilon")) {
         epsilon = parser.value("epsilon").toFloat();
     }
+    if (parser.isSet("polygon-step")) {
+        polygonStep = parser.value("polygon-step").toInt();
+    }
+    if (parser.isSet("polygon-candidates")) {
+        polygonCandidates = parser.value("polygon-candidates").toInt();
+    }
     if (parser.isSet("texture-border")) {
         textureBorder = parser.value("texture-border").toInt();
     }
@@ -156,6 +203,41 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
     if (parser.isSet("format")) {
         format = parser.value("format");
     }
+    if (parser.isSet("no-cache")) {
+        preprocessCache = false;
+    }
+    if (parser.isSet("stable-layout")) {
+        stableLayout = true;
+    }
+    if (parser.isSet("no-page-balance")) {
+        balancePages = false;
+    }
+    if (parser.isSet("fixed-page-size")) {
+        fixedPageSize = true;
+    }
+    if (parser.isSet("no-layout-cache")) {
+        layoutCache = false;
+    }
+    if (parser.isSet("png-trial-threads")) {
+        pngTrialThreads = qMax(0, parser.value("png-trial-threads").toInt());
+    }
+    if (parser.isSet("ccz-level")) {
+        bool ok = false;
+        cczLevel = parser.value("ccz-level").toInt(&ok);
+        if (!ok || (cczLevel < -1) || (cczLevel > 9)) {
+            qCritical() << "Incorrect ccz-level:" << parser.value("ccz-level") << "must be -1..9";
+            return -1;
+        }
+    }
+    if (parser.isSet("variant-threads")) {
+        variantThreads = parser.value("variant-threads").toInt();
+    }
+    if (parser.isSet("scale-pyramid")) {
+        scalePyramid = true;
+    }
+    if (parser.isSet("search-time")) {
+        searchTime = parser.value("search-time").toFloat();
+    }
 
      if (parser.isSet("png-opt-mode")) {
          pngOptMode = parser.value("png-opt-mode");
@@ -166,10 +248,16 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
         pngOptLevel = qBound(1, pngOptLevel, 7);
     }
 
+    if (parser.isSet("png-shared-palette")) {
+        pngSharedPalette = true;
+    }
+
     qDebug() << "trimMode:" << trimMode;
     qDebug() << "algorithm:" << algorithm;
+    qDebug() << "searchTime:" << searchTime;
     qDebug() << "trim:" << trim;
     qDebug() << "epsilon:" << epsilon;
+    qDebug() << "polygonStep:" << polygonStep << "polygonCandidates:" << polygonCandidates;
     qDebug() << "textureBorder:" << textureBorder;
     qDebug() << "spriteBorder:" << spriteBorder;
     qDebug() << "pow2:" << pow2;
@@ -177,6 +265,16 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
     qDebug() << "scale:" << imageScale;
     qDebug() << "png-opt-mode:" << pngOptMode;
     qDebug() << "png-opt-level:" << pngOptLevel;
+    qDebug() << "png-shared-palette:" << pngSharedPalette;
+    qDebug() << "preprocess-cache:" << preprocessCache;
+    qDebug() << "scale-pyramid:" << scalePyramid;
+    qDebug() << "layout-cache:" << layoutCache;
+    qDebug() << "stable-layout:" << stableLayout;
+    qDebug() << "balance-pages:" << balancePages;
+    qDebug() << "fixed-page-size:" << fixedPageSize;
+    qDebug() << "variant-threads:" << variantThreads;
+    qDebug() << "png-trial-threads:" << pngTrialThreads;
+    qDebug() << "ccz-level:" << cczLevel;
 
     // load formats
     QSettings settings;
@@ -200,6 +298,9 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
     qDebug() << "Support Formats:" << PublishSpriteSheet::formats().keys();
 
     if (projectFile) {
+        QSharedPointer<SourceImageStore> sourceStore(new SourceImageStore(1, scalePyramid));
+        QVector<SpriteAtlas> atlases;
+        QStringList atlasFilePaths;
         for (int i=0; i<projectFile->scalingVariants().size(); ++i) {
             ScalingVariant variant = projectFile->scalingVariants().at(i);
 
@@ -230,22 +331,35 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
             SpriteAtlas atlas(QStringList() << projectFile->srcList(), textureBorder, spriteBorder, trim, heuristicMask, pow2, forceSquared, maxSize, scale);
             if (trimMode == "Polygon") {
                 atlas.enablePolygonMode(true, epsilon);
+                atlas.setPolygonSearch(polygonStep, polygonCandidates);
             }
-            if (algorithm == "Polygon") {
-             atlas.setAlgorithm(algorithm);
+            atlas.enablePreprocessCache(preprocessCache, PreprocessCache::storePixels());
+            atlas.setSourceStore(sourceStore);
+            if (layoutCache) {
+                atlas.setLayoutCache(LayoutCache::fileName(source.filePath()));
             }
-            if (!atlas.generate()) {
-                qCritical() << "ERROR: Generate atlas!";
-                return -1;
-            }
-
-            publisher.addSpriteSheet(atlas, destFileInfo.filePath());
+            atlas.setStableLayout(stableLayout);
+            atlas.setMultiPage(balancePages, fixedPageSize);
+            atlas.setAlgorithm(algorithm);
+            atlas.setSearchTimeLimit(searchTime * 1000);
+            atlases.push_back(atlas);
+            atlasFilePaths.push_back(destFileInfo.filePath());
 
             if (!parser.isSet("format")) {
                 format = projectFile->dataFormat();
             }
         }
 
+        sourceStore->setConsumers(atlases.size());
+        QVector<bool> results = SpriteAtlas::generateVariants(atlases, variantThreads);
+        if (results.contains(false)) {
+            qCritical() << "ERROR: Generate atlas!";
+            return -1;
+        }
+        for (int i=0; i<atlases.size(); ++i) {
+            publisher.addSpriteSheet(atlases[i], atlasFilePaths[i]);
+        }
+
         delete projectFile;
         projectFile = nullptr;
     } else {
@@ -253,10 +367,12 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
         SpriteAtlas atlas(QStringList() << source.filePath(), textureBorder, spriteBorder, trim, heuristicMask, pow2, forceSquared, maxSize, imageScale);
         if (trimMode == "Polygon") {
             atlas.enablePolygonMode(true, epsilon);
+            atlas.setPolygonSearch(polygonStep, polygonCandidates);
         }
-        if (algorithm == "Polygon") {
-         atlas.setAlgorithm(algorithm);
-        }
+        atlas.enablePreprocessCache(preprocessCache, PreprocessCache::storePixels());
+        atlas.setMultiPage(balancePages, fixedPageSize);
+        atlas.setAlgorithm(algorithm);
+        atlas.setSearchTimeLimit(searchTime * 1000);
         if (!atlas.generate()) {
             qCritical() << "ERROR: Generate atlas!";
             return -1;
@@ -268,12 +384,17 @@ Lossy - Uses pngquant to optimize the filesize. The reduction is mostly about 70
     publisher.setTrimSpriteNames(trimSpriteNames);
     publisher.setPrependSmartFolderName(prependSmartFolderName);
     publisher.setPngQuality(pngOptMode, pngOptLevel);
+    publisher.setPngSharedPalette(pngSharedPalette);
+    publisher.setPngTrialThreads(pngTrialThreads);
+    publisher.setCczCompressionLevel(cczLevel);
 
     if (!publisher.publish(format, false)) {
         qCritical() << "ERROR: publish atlas!";
         return -1;
     }
 
+    publisher.waitForOptimizePNG();
+
     qDebug() << "Publishing is finished.";
 
 